@@ -1,143 +1,305 @@
 #include "avalanche.hpp"
+#include "metrics.hpp"
+#include "perf.hpp"
+#include "trace.hpp"
+#include <limits>
+#include <numeric>
 #include <algorithm>
 #include <boost/format.hpp>
 #include <fstream>
+#include <stdexcept>
+#include <tuple>
 
 using namespace std;
 
 TxPtr Node::onGenerateTx(int data) {
+  ZKS_SPAN("onGenerateTx", node_id);
+  perf::Scope scope(perf::generate);
 
   auto edge = parentSelection();
 
-  list<UUID> parent_uuids;
-  transform(edge.begin(), edge.end(), back_inserter(parent_uuids),
-            [](auto t) -> UUID { return t->id; });
-  auto t = make_shared<Tx>(data, parent_uuids);
+  TxIndexes parents;
+  transform(edge.begin(), edge.end(), back_inserter(parents),
+            [](auto t) -> TxIndex { return t->idx; });
+  auto &t = network->createTx(data, std::move(parents));
   onReceiveTx(*this, t);
   return t;
 }
 
 // onSendTx is an artefact of our simulation
 // environment: it is called by a node when it first
-// learns from a Tx (e.g., as p)
-TxPtr Node::onSendTx(UUID &id) {
-  auto it = transactions.find(id);
-  assert(it != transactions.end());
-  return make_shared<Tx>(*it->second);
+// learns from a Tx (e.g., as p). Bodies are immutable
+// and shared, so they are read from the network table
+// rather than from this node's state, which another
+// thread may be updating during Network::run.
+TxPtr const &Node::onSendTx(TxIndex id) {
+  return network->table[id];
 }
 
 // lines 5.8 to 5.14
 //
-void Node::onReceiveTx(Node &sender, TxPtr &tx) {
+void Node::onReceiveTx(Node &sender, TxPtr const &tx) {
   // line 5.9: if T ∉ T then
-  if (transactions.find(tx->id) == transactions.end()) {
-    // new transaction:
-    tx->chit = 0;
-    tx->confidence = 0;
-
-    // [SIMUL]
-    // make sure we know every transactions in tx's ancestors.
-    // TODO: check optimization section in paper.
-    for (auto &it : tx->parents)
-      if (transactions.find(it) == transactions.end()) {
-        // simulate the network; this will
-        // allocate a new transaction this Node's
-        // transaction space
-        auto t = sender.onSendTx(it);
-        onReceiveTx(sender, t); // recursive
-      }
+  if (known.test(tx->idx))
+    return;
+  grow(tx->idx);
+
+  // [SIMUL]
+  // make sure we know every transactions in tx's ancestors:
+  // the missing ones are its closure minus the known ones,
+  // fetched in one pass in index order, which is topological
+  // (parents are created first).
+#ifdef ZKS_METRICS
+  auto before = transactions.size();
+#endif
+  if (any_of(tx->parents.begin(), tx->parents.end(),
+             [this](auto p) { return !known.test(p); })) {
+    ZKS_SPAN("fetchAncestors", node_id);
+    forEachMissing(tx->ancestors, known,
+                   [&](auto idx) { insert(sender.onSendTx(idx)); });
+  }
+  ZKS_RECORD(fetches_per_receive, transactions.size() - before);
+  ZKS_COUNT(fetched_txs, transactions.size() - before);
+  insert(tx);
+}
 
-    auto c = conflicts.find(tx->data);
-    if (c != conflicts.end())
-      c->second.size++;
-    else
-      conflicts.insert(make_pair(tx->data, ConflictSet{tx, tx, 0, 1}));
+// adds a new transaction, whose parents are known.
+void Node::insert(TxPtr const &tx) {
+  auto c = conflicts.find(tx->data);
+  if (c != conflicts.end()) {
+    c->second.size++;
+    ZKS_RECORD(conflict_set_size, c->second.size);
+    unprefered.insert(tx->idx);
+    // the preference may no longer be the only member of its set.
+    if (auto &pref = c->second.pref; pref && live(pref->idx))
+      updateFrontier(pref);
+  } else if (tx->data >= 0 && spent.test(tx->data)) {
+    // spends the data of a conflict set that was decided and
+    // pruned: it can only be rejected.
+    ConflictSet cs{nullptr, nullptr, 0, 2};
+    cs.pruned = 1;
+    conflicts.insert(make_pair(tx->data, std::move(cs)));
+    unprefered.insert(tx->idx);
+  } else {
+    conflicts.insert(make_pair(tx->data, ConflictSet{tx, tx, 0, 1}));
+    ZKS_RECORD(conflict_set_size, 1);
+  }
 
-    transactions.insert(make_pair(tx->id, tx));
+  for (auto p : tx->parents) {
+    if (!live(p))
+      continue;
+    auto &siblings = children[p];
+    if (siblings.empty() || siblings.back() != tx->idx) {
+      siblings.push_back(tx->idx);
+      child_edges++;
+    }
   }
+
+  unprefered_ancestors[tx->idx] = int(unprefered.common(tx->ancestors));
+
+  transactions.insert(make_pair(tx->idx, tx));
+  known.set(tx->idx);
+  ZKS_COUNT(received_txs, 1);
+  unqueried.push_back(tx->idx);
+
+  updateFrontier(tx);
+  recent.push_back(tx->idx);
+  if (recent.size() > 10)
+    recent.pop_front();
 }
 
-int Node::onQuery(Node &sender, TxPtr &tx) {
+int Node::onQuery(Node &sender, TxPtr const &tx) {
   onReceiveTx(sender, tx);
   return isStronglyPrefered(tx) ? 1 : 0;
 }
 
-void Node::avalancheLoop() {
-  for (auto it = transactions.begin(); it != transactions.end(); ++it) {
-    auto &T = it.value();
+// query of a vertex of n transactions: bit i of the answer
+// is the vote for txs[i].
+uint64_t Node::onQuery(Node &sender, TxPtr const *txs, size_t n) {
+  uint64_t rc = 0;
+  for (size_t i = 0; i < n; i++)
+    rc |= uint64_t(onQuery(sender, txs[i])) << i;
+  return rc;
+}
 
-    // line 4.3:  find t that satisfies t ∈ T ∧ t ∉ Q
-    if (queried.find(T->id) != queried.end())
-      continue;
+// lines 4.3 to 4.4: pick the transactions to query and
+// sample the peers each one is sent to.
+//
+// With vertex batching (optimization section of the paper),
+// the transactions are grouped by params.batch_size into
+// vertices that share a peer sample. An incomplete vertex
+// waits for more transactions until `now` reaches the
+// deadline (see batchDeadline), or until `flush`.
+void Node::prepareQueries(uint64_t now, bool flush) {
+  ZKS_SPAN("prepareQueries", node_id);
+  perf::Scope scope(perf::prepare);
+  outbox.txs.clear();
+  outbox.vertices.assign(1, 0);
+  outbox.peers.clear();
+  outbox.width = min<size_t>(params.k, network->nodes.size() - 1);
+
+  // line 4.3:  find t that satisfies t ∈ T ∧ t ∉ Q
+  size_t batch = params.batch_size;
+  auto n = unqueried.size() / batch * batch;
+  if (n > 0 || !batching)
+    batch_since = now;
+  if (n < unqueried.size() && (flush || now >= batchDeadline()))
+    n = unqueried.size();
+
+  for (size_t i = 0; i < n; i += batch) {
+    for (size_t j = i; j < min(i + batch, n); j++) {
+      auto &T = transactions.at(unqueried[j]);
+      outbox.txs.push_back(T);
+      inflight.set(T->idx);
+    }
+    outbox.vertices.push_back(outbox.txs.size());
+    ZKS_RECORD(vertex_size, outbox.count(outbox.size() - 1));
 
     // line 4.4:  K := sample(N\u, k)
-    vector<shared_ptr<Node>> K;
-    {
-      auto n = network->nodes;
-      auto r(remove_if(n.begin(), n.end(),
-                       [this](auto &it) { return it.get() == this; }));
-      sample(n.begin(), r, back_inserter(K), params.k, network->rng);
-    }
+    auto &K = sampler.sample(network->nodes.size(), node_id, params.k, rng);
+    outbox.peers.insert(outbox.peers.end(), K.begin(), K.end());
+    ZKS_COUNT(queries, K.size());
+  }
+  ZKS_COUNT(vertices, outbox.size());
+  ZKS_COUNT(queried_txs, n);
+  unqueried.erase(unqueried.begin(), unqueried.begin() + n);
+  batching = !unqueried.empty();
+  outbox.responses.assign(outbox.peers.size(), 0);
+}
 
-    // line 4.5: P := Σ_(v∈K) query(v,T)
-    int P = 0;
-    for (auto &n : K) {
-      auto newtx = make_shared<Tx>(*T);
-      P += n->onQuery(*this, newtx);
-    }
+// the protocol constants: P's, or the node's for Protocol.
+template <class P>
+P const &Node::constants() const {
+  static constexpr P p{};
+  return p;
+}
 
-    // block for line 4.6 to 4.15
-    // line 4.6:  if P ≥ α·k then
-    if (P >= params.alpha * params.k) {
-      // line 4.7: cT :=1
-      T->chit = 1;
-
-      // update the preference for ancestors
-      // line 4.9:  for T′∈ T: T′←∗ T  do
-      for (auto Tp : parentSet(T)) {
-        Tp->confidence++; // missing from figure 4.
-        auto cs = conflicts.find(Tp->data);
-        assert(cs != conflicts.end());
-
-        // line 4.10: if d(T′) > d(PT′.pref) then
-        if (Tp->confidence > cs->second.pref->confidence)
-          // line 4.11: PT′.pref := T′
-          cs->second.pref = Tp;
-
-        // line 4.12: if T′ ≠ PT′.last then
-        if (Tp != cs->second.last)
-          // line 4.13: PT′.last :=  T′, PT′.cnt := 0
-          cs->second.last = Tp, cs->second.count = 0;
-        else
-          // line 4.15: ++PT′.cnt
-          cs->second.count++;
-      }
+template <>
+Protocol const &Node::constants<Protocol>() const {
+  return protocol;
+}
+
+// the configurations the vote path is compiled for, as
+// (k, quorum, β1, β2): the defaults with 50 and 100 nodes, the
+// benchmarks', and k = 10, α = 0.8 with the default β and with
+// the paper's evaluation (β1 = 11, β2 = 150). Any other one runs
+// with Protocol.
+using Specializations =
+    tuple<FixedProtocol<6, 5, 5, 5>, FixedProtocol<11, 9, 5, 5>, FixedProtocol<4, 4, 5, 5>,
+          FixedProtocol<10, 8, 11, 150>, FixedProtocol<10, 8, 5, 5>>;
+
+void Node::dispatch() {
+  apply_queries = &Node::applyQueries<Protocol>;
+  apply_vote = &Node::applyVote<Protocol>;
+  if (params.generic_protocol)
+    return;
+  apply(
+      [this](auto... fixed) {
+        auto match = [this](auto p) {
+          using P = decltype(p);
+          if (P::k == protocol.k && P::quorum == protocol.quorum &&
+              P::beta1 == protocol.beta1 && P::beta2 == protocol.beta2) {
+            apply_queries = &Node::applyQueries<P>;
+            apply_vote = &Node::applyVote<P>;
+          }
+        };
+        (match(fixed), ...);
+      },
+      Specializations{});
+}
+
+bool Node::specialized() const { return apply_vote != &Node::applyVote<Protocol>; }
+
+// lines 4.6 to 4.15, once every query issued by
+// prepareQueries has been answered.
+template <class P>
+void Node::applyQueries() {
+  ZKS_SPAN("applyQueries", node_id);
+  perf::Scope scope(perf::apply);
+  auto &proto = constants<P>();
+  assert(outbox.peers.empty() || outbox.width == size_t(proto.k));
+  for (size_t v = 0; v < outbox.size(); v++) {
+    auto r = outbox.responses.data() + v * outbox.width;
+    for (auto i = outbox.vertices[v]; i < outbox.vertices[v + 1]; i++) {
+      // line 4.5: P := Σ_(v∈K) query(v,T), unrolled for a
+      // fixed k.
+      auto bit = i - outbox.vertices[v];
+      int votes = 0;
+      for (int j = 0; j < proto.k; j++)
+        votes += int((r[j] >> bit) & 1);
+      applyVote<P>(outbox.txs[i], votes);
     }
-    queried.insert(T->id);
   }
+  outbox.txs.clear();
 }
 
-TxSet Node::parentSet(const TxPtr &tx) {
-  if (auto it = parentSets.find(tx->id); it != parentSets.end())
-    return it->second;
+template <class P>
+void Node::applyVote(const TxPtr &T, int votes) {
+  auto &proto = constants<P>();
+  // block for line 4.6 to 4.15
+  // line 4.6:  if P ≥ α·k then, the quorum being ⌈α·k⌉.
+  if (votes >= proto.quorum) {
+    // line 4.7: cT :=1
+    chits.set(T->idx);
+
+    // update the preference for ancestors
+    // line 4.9:  for T′∈ T: T′←∗ T  do
+    for (auto idx : parentSet(T)) {
+      if (!live(idx))
+        continue; // decided and pruned
+      auto &Tp = transactions.at(idx);
+      auto &d = confidence[idx]; // missing from figure 4.
+      if (d < numeric_limits<uint16_t>::max())
+        d++;
+      if (d == 1)
+        updateFrontier(Tp);
+      auto cs = conflicts.find(Tp->data);
+      assert(cs != conflicts.end());
+      wake.push_back(idx);
+      if (!cs->second.pref || !live(cs->second.pref->idx))
+        continue; // decided, partly pruned
+
+      // line 4.10: if d(T′) > d(PT′.pref) then
+      if (d > confidence[cs->second.pref->idx])
+        // line 4.11: PT′.pref := T′
+        setPrefered(cs->second, Tp);
+
+      // line 4.12: if T′ ≠ PT′.last then
+      if (Tp != cs->second.last)
+        // line 4.13: PT′.last :=  T′, PT′.cnt := 0
+        cs->second.last = Tp, cs->second.count = 0;
+      else
+        // line 4.15: ++PT′.cnt
+        cs->second.count++;
+
+      wake.push_back(cs->second.pref->idx);
+    }
+  }
+  inflight.reset(T->idx);
+  queried.set(T->idx);
+  wake.push_back(T->idx);
 
-  vector<TxPtr> parents;
+  accepted_log.clear();
+  updateAccepted<P>();
+}
 
-  set<UUID> pset(tx->parents.begin(), tx->parents.end());
-  while (!pset.empty()) {
-    set<UUID> npset;
-    for (auto &it : pset)
-      if (auto x = transactions.find(it); x != transactions.end()) {
-        parents.push_back(x->second);
-        for (auto &oid : x->second->parents)
-          npset.insert(oid);
-      }
-    pset = npset;
+// one iteration of figure 4 for this node alone: peers are
+// queried directly. Network::run drives all the nodes in
+// phases instead.
+void Node::avalancheLoop() {
+  ZKS_SPAN("avalancheLoop", node_id);
+  prepareQueries();
+  for (size_t slot = 0; slot < outbox.peers.size(); slot++) {
+    auto &n = network->nodes[outbox.peers[slot]];
+    auto v = slot / outbox.width;
+    outbox.responses[slot] = n->onQuery(*this, outbox.vertex(v), outbox.count(v));
   }
+  applyQueries();
+}
 
-  TxSet rc(parents.begin(), parents.end());
-  parentSets[tx->id] = rc;
-  return rc;
+TxBitset const &Node::parentSet(const TxPtr &tx) {
+  ZKS_RECORD(closure_size, tx->ancestors.size());
+  return tx->ancestors;
 }
 
 bool Node::isPrefered(const TxPtr &tx) {
@@ -148,79 +310,174 @@ bool Node::isPrefered(const TxPtr &tx) {
 
 bool Node::isStronglyPrefered(const TxPtr &tx) {
   // line 6.4: return ∀T′ ∈ T ,T′ ←∗ T : isPreferred(T′)
-  if (auto pset = parentSet(tx); !pset.empty())
-    for (auto p = pset.begin(); p != pset.end(); ++p)
-      if (!isPrefered(*p))
-        return false;
-  return true;
+  assert(known.test(tx->idx));
+  if (!live(tx->idx))
+    // pruned: unprefered still holds the rejected transactions.
+    return !unprefered.intersects(tx->ancestors);
+  return unprefered_ancestors[tx->idx] == 0;
 }
 
-bool Node::isAccepted(const TxPtr &tx) {
-  if (accepted.find(tx->id) != accepted.end())
-    return true;
-  if (queried.find(tx->id) == queried.end())
+// change the preference of a conflict set, keeping the
+// unprefered ancestors count of the descendants of both
+// the old and new preference up to date.
+void Node::setPrefered(ConflictSet &cs, const TxPtr &tx) {
+  if (cs.pref == tx)
+    return;
+
+  auto update = [this](TxIndex root, int delta) {
+    TxBitset visited;
+    vector<TxIndex> todo{root};
+    while (!todo.empty()) {
+      auto idx = todo.back();
+      todo.pop_back();
+      if (auto it = children.find(idx); it != children.end())
+        for (auto child : it->second)
+          if (!visited.contains(child)) {
+            visited.insert(child);
+            auto &n = unprefered_ancestors[child];
+            n += delta;
+            if (n == 0 || n == delta)
+              updateFrontier(transactions.at(child));
+            todo.push_back(child);
+          }
+    }
+  };
+
+  unprefered.insert(cs.pref->idx);
+  update(cs.pref->idx, 1);
+  unprefered.erase(tx->idx);
+  update(tx->idx, -1);
+  cs.pref = tx;
+}
+
+// re-evaluate the membership of tx in E′ and, if it changed,
+// the tips of E′ among tx and its parents.
+void Node::updateFrontier(const TxPtr &tx) {
+  auto c = conflicts.find(tx->data);
+  assert(c != conflicts.end());
+  auto in = isStronglyPrefered(tx) &&
+            (c->second.size == 1 || confidence[tx->idx] > 0);
+  if (in == eligible.contains(tx->idx))
+    return;
+
+  if (in) {
+    eligible.insert(tx->idx);
+    for (auto p : tx->parents)
+      if (live(p) && eligible_children[p]++ == 0)
+        tips.unordered_erase(p);
+    if (eligible_children[tx->idx] == 0)
+      tips.insert(tx->idx);
+  } else {
+    eligible.erase(tx->idx);
+    for (auto p : tx->parents)
+      if (live(p) && --eligible_children[p] == 0 && eligible.contains(p))
+        tips.insert(p);
+    tips.unordered_erase(tx->idx);
+  }
+}
+
+// once pruned, only the rejected transactions are left in
+// unprefered (see prune).
+bool Node::isAccepted(TxIndex idx) const {
+  return live(idx) ? accepted.test(idx) : !unprefered.contains(idx);
+}
+
+// acceptance predicate of section IV.1 for a transaction that
+// is not accepted yet.
+template <class P>
+bool Node::acceptable(TxIndex idx) {
+  if (accepted.test(idx) || !queried.test(idx))
     return false;
+  auto &proto = constants<P>();
+  auto &tx = transactions.at(idx);
   auto c{conflicts.find(tx->data)};
   assert(c != conflicts.end());
-  auto cs{c->second};
-  auto parents_accepted{[tx, this]() {
-    for (auto it : tx->parents)
-      if (accepted.find(it) == accepted.end())
-        return false;
+  auto &cs{c->second};
+  if (cs.pref == tx && cs.count > proto.beta2) {
+    ZKS_COUNT(accepted_beta2, 1);
     return true;
-  }()};
-  auto rc{(parents_accepted && cs.size == 1 && tx->confidence > params.beta1) ||
-          (cs.pref == tx && cs.count > params.beta2)};
-  if (rc)
-    accepted.insert(tx->id);
-  return rc;
+  }
+  if (cs.size != 1 || confidence[idx] <= proto.beta1)
+    return false;
+  if (!all_of(tx->parents.begin(), tx->parents.end(),
+              [this](auto p) { return isAccepted(p); }))
+    return false;
+  ZKS_COUNT(accepted_beta1, 1);
+  return true;
+}
+
+// acceptance only depends on the transaction's confidence,
+// chit, conflict set and parents, so instead of re-scanning
+// the DAG, applyVote pushes to `wake` the transactions whose
+// inputs changed. Accepting a transaction wakes its children,
+// which may have been waiting for their last parent.
+template <class P>
+void Node::updateAccepted() {
+  while (!wake.empty()) {
+    auto idx = wake.back();
+    wake.pop_back();
+    if (!acceptable<P>(idx))
+      continue;
+    accepted.set(idx);
+    num_accepted++;
+    accepted_log.push_back(idx);
+    if (auto it = children.find(idx); it != children.end())
+      wake.insert(wake.end(), it->second.begin(), it->second.end());
+  }
 }
 
+bool Node::knows(TxIndex idx) const { return known.test(idx); }
+
 // TODO: check it is the right strategy
 // figure 19
 //
 
 vector<TxPtr> Node::parentSelection() {
+  ZKS_SPAN("parentSelection", node_id);
   // Avalanche paper section IV.2: Parent Selection
   //   E = {T : ∀ T ∈ T, isStronglyPreferred(T)}
   //   E′ := {T : |PT|=1 ∨ d(T)>0, ∀T ∈ E}.
-  vector<TxPtr> E0, E1;
-  for (auto [id, T] : transactions)
-    if (isStronglyPrefered(T)) {
-      E0.push_back(T);
-      auto c = conflicts.find(T->data);
-      assert(c != conflicts.end());
-      if (c->second.size == 1 || T->confidence > 0)
-        E1.push_back(T);
+  // parents are picked from the frontier of E′ (see updateFrontier).
+  //
+  // at most params.max_parents are kept, and none of them is an
+  // ancestor of another: candidates are visited from the most
+  // recent one, and an ancestor always has a lower index than its
+  // descendants, so it is enough to check the closures of the
+  // parents already chosen.
+  auto reduce = [this](vector<TxIndex> candidates) {
+    sort(candidates.begin(), candidates.end(), greater<TxIndex>());
+    vector<TxPtr> rc;
+    for (auto idx : candidates) {
+      if (int(rc.size()) >= params.max_parents)
+        break;
+      if (none_of(rc.begin(), rc.end(), [this, idx](auto &p) {
+            return parentSet(p).contains(idx);
+          }))
+        rc.push_back(transactions.at(idx));
     }
+    return rc;
+  };
 
-  vector<TxPtr> parents;
-  for (auto &it : E1)
-    for (auto &jt : parentSet(it))
-      if (find(E1.begin(), E1.end(), jt) == E1.end())
-        parents.push_back(jt);
-
-  // cout << "parentSelection : eps0.size = " << E0.size() << " eps1.size = "
-  //      << E1.size() << " parents.size = " << parents.size() << endl;
+  ZKS_RECORD(eligible_size, eligible.size());
+  ZKS_RECORD(frontier_size, tips.size());
+  auto parents = reduce({tips.begin(), tips.end()});
 
   vector<TxPtr> fallback;
-  if (transactions.size() == 1)
+  if (watermark == 0 && transactions.size() == 1)
     fallback.push_back(genesis);
   else {
-    vector<TxPtr> tx10;
-    int n{10};
-    for (auto it = transactions.rbegin(); it != transactions.rend() && n > 0;
-         ++it, --n)
-      tx10.push_back(it->second);
-
-    vector<TxPtr> tx3;
-    for (auto &e : tx10) {
+    vector<TxIndex> tx3, sampled;
+    for (auto it = recent.rbegin(); it != recent.rend(); ++it) {
+      if (!live(*it))
+        continue;
+      auto &e = transactions.at(*it);
       auto c = conflicts.find(e->data);
       assert(c != conflicts.end());
       if (!isAccepted(e) && c->second.size == 1)
-        tx3.push_back(e);
+        tx3.push_back(e->idx);
     }
-    sample(tx3.begin(), tx3.end(), back_inserter(fallback), 3, network->rng);
+    sample(tx3.begin(), tx3.end(), back_inserter(sampled), 3, rng);
+    fallback = reduce(sampled);
   }
 
   assert(!(parents.empty() && fallback.empty()));
@@ -229,16 +486,172 @@ vector<TxPtr> Node::parentSelection() {
   return fallback;
 }
 
-double Node::fractionAccepted() {
-  int rc{0};
-  for (auto it = transactions.begin(); it != transactions.end(); ++it)
-    if (isAccepted(it->second))
-      rc++;
+// the transactions stepped over by prune were never received,
+// they are left out as they would be without pruning; the
+// residual ones are counted with the transactions held.
+double Node::fractionAccepted() const {
+  auto pruned = watermark - skipped - residual.size();
+  return double(num_accepted) / (pruned + transactions.size());
+}
 
-  return double(rc) / transactions.size();
+// estimates from the sizes and capacities of the containers:
+// hash tables count a bucket and, for node-based ones, a node
+// with its links per entry, trees three links and a color.
+NodeMemory Node::memory() const {
+  auto hashed = [](auto &c, size_t entry) { return c.bucket_count() * sizeof(void *) + c.size() * entry; };
+  NodeMemory m;
+  m.transactions = hashed(transactions, sizeof(pair<TxIndex, TxPtr>)) + residual.bytes();
+  m.conflicts = conflicts.size() * (sizeof(pair<const int, ConflictSet>) + 4 * sizeof(void *)) +
+                spent.bytes();
+  m.children = hashed(children, sizeof(pair<const TxIndex, TxIndexes>) + 2 * sizeof(void *)) +
+               child_edges * sizeof(TxIndex);
+  for (auto b : {&known, &queried, &accepted, &chits, &inflight})
+    m.vote_state += b->bytes();
+  m.vote_state += confidence.bytes();
+  m.preference = unprefered.bytes() + unprefered_ancestors.bytes();
+  m.parent_selection = eligible.bytes() + eligible_children.bytes() +
+                       hashed(tips, sizeof(TxIndex)) + recent.size() * sizeof(TxIndex);
+  m.queues = (unqueried.capacity() + wake.capacity() + accepted_log.capacity()) * sizeof(TxIndex) +
+             outbox.txs.capacity() * sizeof(TxPtr) + outbox.vertices.capacity() * sizeof(uint32_t) +
+             outbox.peers.capacity() * sizeof(int) + outbox.responses.capacity() * sizeof(uint64_t);
+  return m;
+}
+
+// pruning: the transactions below the watermark are forgotten.
+// A transaction is pruned once it is queried and decided, i.e.
+// the preference of its conflict set is accepted (it is then
+// either accepted or rejected for good), unless it may be a tip
+// of E′, a parent for the next transactions: a member of E′ is
+// held until one of its children in E′ is accepted, as it
+// becomes a tip again whenever its children leave E′. A conflict
+// set goes when all its members are pruned, leaving its data in
+// spent.
+//
+// The watermark moves past the transactions pruned and, once
+// they are residual_lag indexes behind the last one, past the
+// others too, which stay live in residual until they are pruned:
+// a conflict set that neither side wins never holds it back.
+void Node::prune() {
+  if (!params.prune)
+    return;
+  perf::Scope scope(perf::prune);
+  auto decided = [this](ConflictSet const &cs) {
+    return !cs.pref || isAccepted(cs.pref->idx);
+  };
+  auto held = [this](TxIndex idx) {
+    if (!eligible.contains(idx))
+      return false;
+    auto ch = children.find(idx);
+    return ch == children.end() ||
+           none_of(ch->second.begin(), ch->second.end(), [this](auto c) {
+             return eligible.contains(c) && accepted.test(c);
+           });
+  };
+  // forgets idx if it can be, returns whether it did.
+  auto settle = [&](TxIndex idx) {
+    if (!known.test(idx)) {
+      // [SIMUL] a transaction this node never received, usually
+      // a double spend nothing was built upon. If its data is
+      // decided here, it could only be rejected: it is recorded
+      // as such instead of being waited for.
+      auto &tx = network->table[idx];
+      auto c = conflicts.find(tx->data);
+      if (c == conflicts.end() ? tx->data < 0 || !spent.test(tx->data) : !decided(c->second))
+        return false;
+      grow(idx);
+      known.set(idx);
+      unprefered.insert(idx);
+      skipped++;
+      return true;
+    }
+    if (!queried.test(idx) || held(idx))
+      return false;
+    auto it = transactions.find(idx);
+    assert(it != transactions.end());
+    auto c = conflicts.find(it->second->data);
+    assert(c != conflicts.end());
+    if (!decided(c->second))
+      return false;
+
+    eligible.erase(idx);
+    if (auto ch = children.find(idx); ch != children.end()) {
+      child_edges -= ch->second.size();
+      children.erase(ch);
+    }
+    // a residual parent outlives its children.
+    for (auto p : it->second->parents)
+      if (p < idx && residual.contains(p)) {
+        auto &siblings = children[p];
+        auto s = find(siblings.begin(), siblings.end(), idx);
+        if (s != siblings.end()) {
+          siblings.erase(s);
+          child_edges--;
+        }
+      }
+    if (++c->second.pruned == c->second.size) {
+      if (c->first >= 0)
+        spent.set(c->first);
+      conflicts.erase(c);
+    }
+    transactions.unordered_erase(it);
+    return true;
+  };
+
+  for (auto idx : TxIndexes(residual.begin(), residual.end()))
+    if (settle(idx)) {
+      residual.erase(idx);
+      for (auto b : {&known, &queried, &accepted, &chits, &inflight})
+        b->forget(idx);
+      confidence.forget(idx);
+      unprefered_ancestors.forget(idx);
+      eligible_children.forget(idx);
+    }
+  while (watermark < network->table.size()) {
+    if (!settle(watermark)) {
+      if (watermark + residual_lag > network->table.size())
+        break;
+      grow(watermark);
+      residual.insert(watermark);
+    }
+    watermark++;
+  }
+  spent.trim();
+  rebase();
+}
+
+// drops the per-transaction arrays below the watermark but for
+// the residual transactions, once it frees at least half of them.
+void Node::rebase() {
+  auto base = watermark / 64 * 64;
+  auto live = confidence.size() - confidence.base();
+  if (base - confidence.base() < max<size_t>(4096, live / 2))
+    return;
+  for (auto b : {&known, &queried, &chits})
+    b->rebase(base, true, residual);
+  for (auto b : {&accepted, &inflight})
+    b->rebase(base, false, residual);
+  confidence.rebase(base, residual);
+  unprefered_ancestors.rebase(base, residual);
+  eligible_children.rebase(base, residual);
+}
+
+// releases the capacity left by pruning: the containers keep
+// their buckets and words once emptied.
+void Node::compact() {
+  transactions.shrink_to_fit();
+  children.rehash(0);
+  tips.shrink_to_fit();
+  for (auto v : {&unqueried, &wake, &accepted_log})
+    v->shrink_to_fit();
+  for (auto b : {&known, &queried, &accepted, &chits, &inflight, &spent})
+    b->shrink();
+  confidence.shrink();
+  unprefered_ancestors.shrink();
+  eligible_children.shrink();
 }
 
 void Node::dumpDag(const std::string &fname) {
+  ZKS_SPAN("dumpDag", node_id);
   ofstream fs;
   fs.open(fname);
   fs << "digraph G{\n";
@@ -246,17 +659,108 @@ void Node::dumpDag(const std::string &fname) {
     auto color = isAccepted(tx) ? "color=lightblue; style=filled;" : "";
     auto c = conflicts.find(tx->data);
     auto pref = (c->second.size > 1 && isPrefered(tx)) ? "*" : "";
-    auto chit = queried.find(id) != queried.end() ? to_string(tx->chit) : "?";
+    auto chit = queried.test(id) ? to_string(int(chits.test(id))) : "?";
     fs << boost::format("\"%s\" [%s  label=\"%d%s, %s, %d\"];\n") %
               boost::uuids::to_string(tx->id) % color % tx->data % pref % chit %
-              tx->confidence;
+              confidence[id];
   }
   for (auto &[id, tx] : transactions) {
     for (auto &p : tx->parents) {
+      if (!live(p))
+        continue;
       fs << boost::format("\"%s\" -> \"%s\"\n") %
-                boost::uuids::to_string(tx->id) % boost::uuids::to_string(p);
+                boost::uuids::to_string(tx->id) %
+                boost::uuids::to_string(network->table.uuid(p));
     }
   }
   fs << "}\n";
   fs.close();
-}
\ No newline at end of file
+}
+// one tick of the network, in three phases so that nodes can
+// run concurrently and the outcome does not depend on the
+// number of threads:
+//   1. every node picks its queries and samples its peers;
+//   2. every peer answers the queries it received, ordered by
+//      sender and query, updating only its own state;
+//   3. every node applies the answers to its own queries.
+void Network::run() {
+  ZKS_SPAN("Network::run", -1);
+  pool.parallel_for(nodes.size(), [this](size_t i) { nodes[i]->prepareQueries(ticks); });
+  ticks++;
+
+  for (auto &inbox : inboxes)
+    inbox.clear();
+  for (auto &u : nodes)
+    for (size_t slot = 0; slot < u->outbox.peers.size(); slot++)
+      inboxes[u->outbox.peers[slot]].push_back({u->node_id, slot});
+
+  pool.parallel_for(nodes.size(), [this](size_t v) {
+    ZKS_SPAN("onQuery", int(v));
+    perf::Scope scope(perf::query, inboxes[v].size());
+    for (auto &m : inboxes[v]) {
+      auto &u = *nodes[m.sender];
+      auto i = m.slot / u.outbox.width;
+      u.outbox.responses[m.slot] =
+          nodes[v]->onQuery(u, u.outbox.vertex(i), u.outbox.count(i));
+    }
+  });
+
+  pool.parallel_for(nodes.size(), [this](size_t i) {
+    nodes[i]->applyQueries();
+    nodes[i]->prune();
+  });
+  prune();
+}
+
+// moves the network watermark up to the lowest watermark of the
+// nodes: below it, every node has pruned every transaction but
+// its residual ones, so the table can release the other bodies.
+void Network::prune() {
+  if (!params.prune)
+    return;
+  auto w = numeric_limits<TxIndex>::max();
+  for (auto &n : nodes)
+    w = min(w, n->watermark);
+  if (w <= watermark)
+    return;
+
+  TxBitset losers, live;
+  for (auto &n : nodes) {
+    for (auto it = n->unprefered.lower_bound(watermark); it != n->unprefered.end() && *it < w; ++it)
+      losers.insert(*it);
+    for (auto it = n->residual.lower_bound(watermark); it != n->residual.end() && *it < w; ++it)
+      live.insert(*it);
+  }
+  table.prune(w, losers, live);
+  watermark = w;
+}
+
+size_t Network::memory() const {
+  auto rc = table.bytes();
+  for (auto &n : nodes)
+    rc += n->memory().total();
+  return rc;
+}
+
+bool Network::checkMemory() {
+  if (!params.memory_budget)
+    return false;
+  auto used = memory();
+  if (used <= params.memory_budget)
+    return false;
+  if (params.memory_policy == "prune" && !params.prune) {
+    params.prune = true;
+    for (auto &n : nodes) {
+      n->params.prune = true;
+      n->prune();
+      n->compact();
+    }
+    prune();
+    used = memory();
+    if (used <= params.memory_budget)
+      return true;
+  }
+  throw runtime_error((boost::format("memory budget exceeded: %.1f MB of %.1f MB") %
+                       (used / 1048576.0) % (params.memory_budget / 1048576.0))
+                          .str());
+}
@@ -2,87 +2,83 @@
 #include <set>
 #include <map>
 #include <list>
+#include <deque>
 #include <random>
+#include <cassert>
+#include <cmath>
+#include <cstring>
 #include <memory>
 #include <vector>
+#include <cstdint>
 #include <sstream>
 #include <iostream>
 #include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/functional/hash.hpp>
-#include <boost/uuid/uuid_generators.hpp>
 
+#include "random.hpp"
 #include "parameters.hpp"
+#include "thread_pool.hpp"
+#include "txset.hpp"
 #include "tsl/ordered_map.h"
+#include "tsl/ordered_set.h"
 
 using UUID = boost::uuids::uuid;
 
-// TODO: move semantics
+using TxIndexes = std::vector<TxIndex>;
+
+// immutable transaction body, shared by every node of the
+// network. Per-node vote state (chit, confidence) lives in
+// Node::votes.
 struct Tx
 {
+    TxIndex idx;
     boost::uuids::uuid id;
     int data;
-    std::list<UUID> parents;
-    int chit;
-    int confidence;
-    std::string strid;
+    TxIndexes parents;
+    TxBitset ancestors; // closure of parents (see TxTable::prune)
 
-    Tx(int data, std::list<UUID> parents, int chit = 0, int confidence = 0)
-        : id(boost::uuids::random_generator()()),
-          data(data), parents(std::move(parents)), chit(chit),
-          confidence(confidence)
+    Tx(TxIndex idx, UUID const &id, int data, TxIndexes parents, TxBitset ancestors)
+        : idx(idx), id(id), data(data), parents(std::move(parents)),
+          ancestors(std::move(ancestors))
     {
-        strid = boost::uuids::to_string(id).substr(0, 5);
     }
 
-    Tx(Tx &tx)
-        : id(tx.id), data(tx.data), parents(tx.parents),
-          chit(tx.chit), confidence(tx.confidence), strid(tx.strid)
+    // short id, for display
+    std::string strid() const
     {
+        return boost::uuids::to_string(id).substr(0, 5);
     }
 
-    Tx(Tx &&tx)
-        : id(std::move(tx.id)), data(tx.data), parents(std::move(tx.parents)),
-          chit(tx.chit), confidence(tx.confidence), strid(tx.strid)
-    {
-    }
+    Tx(Tx const &) = delete;
+    Tx &operator=(Tx const &) = delete;
 
     bool operator<(Tx const &tx) const
     {
-        return id < tx.id;
+        return idx < tx.idx;
     }
 
     bool operator==(Tx const &tx) const
     {
-        return id == tx.id && data == tx.data &&
-               parents == tx.parents &&
-               chit == tx.chit && confidence == tx.confidence;
+        return idx == tx.idx && data == tx.data &&
+               parents == tx.parents;
     }
 
     bool operator!=(Tx const &tx) const
     {
-        return id != tx.id;
-    }
-
-    Tx &operator=(Tx &&tx)
-    {
-        id = std::move(tx.id);
-        data = std::move(tx.data);
-        parents = std::move(tx.parents);
-        chit = std::move(tx.chit);
-        confidence = std::move(tx.confidence);
-        return *this;
+        return idx != tx.idx;
     }
 
     friend std::ostream &operator<<(std::ostream &out, Tx const &tx)
     {
-        out << "T(id=" << boost::uuids::to_string(tx.id).substr(0, 5) << ", data=" << tx.data
+        out << "T(id=" << tx.strid() << ", data=" << tx.data
             << ", parents=[";
         for (auto const &x : tx.parents)
-            out << boost::uuids::to_string(x).substr(0, 5) << ",";
-        out << "], chit=" << tx.chit << ", confidence=" << tx.confidence << ")";
+            out << "#" << x << ",";
+        out << "])";
         return out;
     }
 
@@ -96,16 +92,121 @@ inline std::string Tx::to_string() const
     return ss.str();
 }
 
-using TxPtr = std::shared_ptr<Tx>;
+using TxPtr = std::shared_ptr<const Tx>;
 using TxSet = std::set<TxPtr>;
 
+// version 4 UUIDs drawn from a seeded generator, so that runs
+// with the same seed produce the same transaction ids.
+class UuidGenerator
+{
+public:
+    explicit UuidGenerator(std::uint64_t seed)
+        : rng(seed, ~std::uint64_t(0)) {}
+
+    UUID operator()()
+    {
+        UUID id;
+        std::uint64_t bits[2] = {rng(), rng()};
+        std::memcpy(id.data, bits, sizeof(bits));
+        id.data[6] = (id.data[6] & 0x0f) | 0x40; // version 4
+        id.data[8] = (id.data[8] & 0x3f) | 0x80; // variant 1
+        return id;
+    }
+
+private:
+    friend class Snapshot;
+
+    CounterRng rng;
+};
+
+// interning table: assigns every transaction created in the
+// network a dense index and owns its body. The UUID is only
+// kept for display purposes (dumpDag, console output).
+class TxTable
+{
+public:
+    TxPtr const &create(UUID const &id, int data, TxIndexes parents)
+    {
+        // the ancestor closure is the union of the parents' closures.
+        TxBitset ancestors;
+        for (auto p : parents)
+        {
+            ancestors.merge((*this)[p]->ancestors);
+            ancestors.insert(p);
+        }
+        ancestors.prune(watermark, kept);
+        auto idx = TxIndex(txs.size());
+        txs.push_back(std::make_shared<const Tx>(idx, id, data, std::move(parents),
+                                                 std::move(ancestors)));
+        body_bytes += footprint(*txs.back());
+        return txs.back();
+    }
+
+    TxPtr const &operator[](TxIndex idx) const
+    {
+        assert(idx < txs.size());
+        return txs[idx];
+    }
+
+    UUID const &uuid(TxIndex idx) const
+    {
+        return (*this)[idx]->id;
+    }
+
+    std::size_t size() const { return txs.size(); }
+
+    // every node has moved its watermark past `below` (see
+    // Node::prune), `losers` being the transactions that were
+    // rejected and `live` the ones still held by some node as
+    // residual: the other bodies are released, and the closures
+    // of new transactions only keep these below the watermark, as
+    // the rejected ones still make their descendants unprefered
+    // and the live ones may still change preference.
+    void prune(TxIndex below, TxBitset const &losers, TxBitset const &live)
+    {
+        for (auto idx = watermark; idx < below; idx++)
+        {
+            if (live.contains(idx))
+                continue;
+            body_bytes -= footprint(*txs[idx]);
+            txs[idx].reset();
+        }
+        kept.merge(losers);
+        kept.merge(live);
+        watermark = below;
+    }
+
+    // estimated bytes held by the table and the bodies it holds.
+    std::size_t bytes() const
+    {
+        return txs.capacity() * sizeof(TxPtr) + body_bytes + kept.bytes();
+    }
+
+private:
+    friend class Snapshot;
+
+    // a body and its control block (make_shared)
+    static std::size_t footprint(Tx const &tx)
+    {
+        return sizeof(Tx) + 2 * sizeof(void *) + tx.parents.capacity() * sizeof(TxIndex) +
+               tx.ancestors.bytes();
+    }
+
+    std::vector<TxPtr> txs;
+    TxIndex watermark = 0;
+    TxBitset kept; // kept in closures below the watermark
+    std::size_t body_bytes = 0;
+};
+
 struct ConflictSet
 {
     TxPtr pref = 0, last = 0;
     int count, size;
+    int pruned = 0; // members below the node's watermark
 
     ConflictSet(ConflictSet &&cs)
-        : pref(std::move(cs.pref)), last(std::move(cs.last)), count(std::move(cs.count)), size(std::move(cs.size))
+        : pref(std::move(cs.pref)), last(std::move(cs.last)), count(std::move(cs.count)), size(std::move(cs.size)),
+          pruned(cs.pruned)
     {
     }
 
@@ -113,7 +214,7 @@ struct ConflictSet
         : pref(pref), last(last), count(count), size(size) {}
 
     ConflictSet(const ConflictSet &cs)
-        : pref(cs.pref), last(cs.last), count(cs.count), size(cs.size) {}
+        : pref(cs.pref), last(cs.last), count(cs.count), size(cs.size), pruned(cs.pruned) {}
 
     ConflictSet &operator=(const ConflictSet &cs)
     {
@@ -121,6 +222,7 @@ struct ConflictSet
         last = cs.pref;
         count = cs.count;
         size = cs.size;
+        pruned = cs.pruned;
         return *this;
     }
 
@@ -130,6 +232,7 @@ struct ConflictSet
         last = std::move(cs.pref);
         count = std::move(cs.count);
         size = std::move(cs.size);
+        pruned = cs.pruned;
         return *this;
     }
     ConflictSet() = delete;
@@ -137,67 +240,270 @@ struct ConflictSet
 
 class Network;
 
+// estimated bytes held by a node, per group of containers (see
+// Node::memory).
+struct NodeMemory
+{
+    std::size_t transactions = 0;     // transactions, residual
+    std::size_t conflicts = 0;        // conflicts, spent
+    std::size_t children = 0;         // children
+    std::size_t vote_state = 0;       // known ... inflight, confidence
+    std::size_t preference = 0;       // unprefered, unprefered_ancestors
+    std::size_t parent_selection = 0; // eligible, eligible_children, tips, recent
+    std::size_t queues = 0;           // unqueried, wake, accepted_log, outbox
+
+    std::size_t total() const
+    {
+        return transactions + conflicts + children + vote_state + preference +
+               parent_selection + queues;
+    }
+
+    NodeMemory &operator+=(NodeMemory const &m)
+    {
+        transactions += m.transactions;
+        conflicts += m.conflicts;
+        children += m.children;
+        vote_state += m.vote_state;
+        preference += m.preference;
+        parent_selection += m.parent_selection;
+        queues += m.queues;
+        return *this;
+    }
+};
+
+// Protocol constants of the vote path (figure 4, section IV.1):
+// k, the peers answering a query (the sample size, bounded by the
+// other nodes), the quorum, the least number of votes P with
+// P ≥ α·k, and β1, β2. Protocol holds them at run time and
+// FixedProtocol at compile time, for the configurations the vote
+// path is instantiated for (see Node::dispatch).
+struct Protocol
+{
+    int k, quorum, beta1, beta2;
+
+    explicit Protocol(Parameters const &params)
+        : k(std::max(0, std::min(params.k, params.num_nodes))),
+          quorum(int(std::ceil(params.alpha * params.k))),
+          beta1(params.beta1), beta2(params.beta2) {}
+};
+
+template <int K, int Quorum, int Beta1, int Beta2>
+struct FixedProtocol
+{
+    static constexpr int k = K, quorum = Quorum, beta1 = Beta1, beta2 = Beta2;
+};
+
 class Node
 {
 public:
     Node(int id, Parameters const &params,
-         Network *network, Tx &tx_genesis)
+         Network *network, TxPtr const &tx_genesis)
         : node_id(id), params(params), network(network),
-          genesis(std::make_shared<Tx>(tx_genesis))
+          rng(params.seed, id), genesis(tx_genesis), protocol(params)
     {
-        transactions.insert({genesis->id, genesis});
-        queried.insert(genesis->id);
-        accepted.insert(genesis->id);
+        dispatch();
+        transactions.insert({genesis->idx, genesis});
+        grow(genesis->idx);
+        known.set(genesis->idx);
+        chits.set(genesis->idx);
+        queried.set(genesis->idx);
+        accepted.set(genesis->idx);
+        num_accepted = 1;
         conflicts.insert({genesis->data, ConflictSet{genesis, genesis, 0, 1}});
-        parentSets.insert({genesis->id, {}});
+        updateFrontier(genesis);
+        recent.push_back(genesis->idx);
     }
 
     TxPtr onGenerateTx(int);
-    void onReceiveTx(Node &, TxPtr &);
-    TxPtr onSendTx(UUID &);
-    int onQuery(Node &, TxPtr &);
+    void onReceiveTx(Node &, TxPtr const &);
+    TxPtr const &onSendTx(TxIndex);
+    int onQuery(Node &, TxPtr const &);
+    std::uint64_t onQuery(Node &, TxPtr const *, std::size_t);
     void avalancheLoop();
+    void prepareQueries(std::uint64_t now, bool flush = false);
+    void prepareQueries() { prepareQueries(0, true); }
+    // when the incomplete vertex left by prepareQueries, if any,
+    // is due, in the unit of params.batch_timeout.
+    std::uint64_t batchDeadline() const { return batch_since + params.batch_timeout; }
+    bool batchPending() const { return batching; }
+    void applyQueries() { (this->*apply_queries)(); }
+    void applyVote(const TxPtr &T, int P) { (this->*apply_vote)(T, P); }
+    // whether the vote path runs with compile-time constants.
+    bool specialized() const;
+    TxIndexes const &newlyAccepted() const { return accepted_log; }
+    bool knows(TxIndex) const;
     std::vector<TxPtr> parentSelection();
-    bool isAccepted(const TxPtr &);
-    double fractionAccepted();
+    bool isAccepted(const TxPtr &tx) const { return isAccepted(tx->idx); }
+    // whether the node still holds the state of idx: at or above
+    // the watermark, or residual (see prune).
+    bool live(TxIndex idx) const { return idx >= watermark || residual.contains(idx); }
+    bool isAccepted(TxIndex) const;
+    double fractionAccepted() const;
+    NodeMemory memory() const;
+    void prune();
     void dumpDag(const std::string &);
+    TxBitset const &parentSet(const TxPtr &);
+    bool isPrefered(const TxPtr &);
+    bool isStronglyPrefered(const TxPtr &);
     int node_id;
 
 private:
-    TxSet parentSet(const TxPtr &);
-    bool isPrefered(const TxPtr &);
-    bool isStronglyPrefered(const TxPtr &);
+    friend class Network;
+    friend class EventSimulation;
+    friend class Snapshot;
+
+    void insert(TxPtr const &);
+    void setPrefered(ConflictSet &, const TxPtr &);
+    void updateFrontier(const TxPtr &);
+    // the vote path, instantiated for the protocol constants P:
+    // a FixedProtocol, or Protocol for the runtime fallback.
+    void dispatch();
+    template <class P>
+    P const &constants() const;
+    template <class P>
+    void applyQueries();
+    template <class P>
+    void applyVote(const TxPtr &, int);
+    template <class P>
+    void updateAccepted();
+    template <class P>
+    bool acceptable(TxIndex);
+    void rebase();
+    void compact();
+    void grow(TxIndex idx)
+    {
+        if (idx < confidence.size())
+            return;
+        auto n = std::max<std::size_t>(idx + 1, 2 * confidence.size() - confidence.base());
+        for (auto b : {&known, &queried, &accepted, &chits, &inflight})
+            b->grow(n);
+        confidence.resize(n);
+        unprefered_ancestors.resize(n);
+        eligible_children.resize(n);
+    }
 
     Parameters params;
     Network *network;
+    CounterRng rng; // stream (params.seed, node_id)
+    PeerSampler sampler;
     TxPtr genesis;
-    tsl::ordered_map<UUID, TxPtr, boost::hash<UUID>> transactions;
-    std::set<UUID> queried, accepted;
+    Protocol protocol;
+    void (Node::*apply_queries)();
+    void (Node::*apply_vote)(const TxPtr &, int);
+    tsl::ordered_map<TxIndex, TxPtr> transactions;
     std::map<int, ConflictSet> conflicts; // TODO UTXO
-    std::map<UUID, TxSet> parentSets;
+    std::unordered_map<TxIndex, TxIndexes> children;
+    std::size_t child_edges = 0; // indexes in children
+    TxIndexes unqueried; // not yet in a vertex, see prepareQueries
+
+    // pruning (params.prune): the transactions below the
+    // watermark are decided and have been forgotten (see prune),
+    // but for the residual ones, still undecided, that it passed
+    // once they fell residual_lag indexes behind.
+    // spent: data of the conflict sets pruned altogether, dense
+    // from 0 as the client spends 0, 1, ... (the genesis spends -1,
+    // which is never spent again).
+    // skipped: indexes below it the node never received.
+    static constexpr TxIndex residual_lag = 256;
+    TxIndex watermark = 0;
+    TxIndex skipped = 0;
+    TxBitset residual;
+    TxBitmap spent;
+    std::uint64_t batch_since = 0;
+    bool batching = false;
+
+    // per-transaction vote state, as arrays indexed by TxIndex
+    // (see grow). inflight: queried, waiting for answers.
+    TxBitmap known, queried, accepted, chits, inflight;
+    TxArray<std::uint16_t> confidence; // saturating
+
+    // acceptance is re-evaluated only for the transactions pushed
+    // to wake, i.e. whose inputs changed (see updateAccepted).
+    // accepted_log: the transactions accepted by the last vote.
+    TxIndexes wake, accepted_log;
+    std::size_t num_accepted = 0;
+
+    // known transactions that are not the preference of their
+    // conflict set, and for every transaction the number of such
+    // ancestors (0 <=> strongly prefered).
+    TxBitset unprefered;
+    TxArray<std::int32_t> unprefered_ancestors;
+
+    // parent selection sets (section IV.2), maintained as
+    // preferences, confidences and conflict sets change:
+    // eligible is E′, tips the members of E′ without a child
+    // in E′, and recent the last transactions received.
+    TxBitset eligible;
+    TxArray<std::int32_t> eligible_children;
+    tsl::ordered_set<TxIndex> tips;
+    std::deque<TxIndex> recent;
+
+    // queries issued by prepareQueries: vertex i holds
+    // txs[vertices[i] ... vertices[i + 1][, is sent to
+    // peers[i * width ... (i + 1) * width[ and their answers, one
+    // bit per transaction, are collected in responses before
+    // applyQueries.
+    struct Outbox
+    {
+        std::vector<TxPtr> txs;
+        std::vector<std::uint32_t> vertices{0};
+        std::vector<int> peers;
+        std::vector<std::uint64_t> responses;
+        std::size_t width = 0;
+
+        std::size_t size() const { return vertices.size() - 1; }
+        TxPtr const *vertex(std::size_t i) const { return txs.data() + vertices[i]; }
+        std::size_t count(std::size_t i) const { return vertices[i + 1] - vertices[i]; }
+    } outbox;
 };
 
 class Network
 {
 public:
     Network(Parameters const &params)
-        : params(params), rng(params.seed), genesis(-1, {}, 1)
+        : params(params), rng(params.seed), uuids(params.seed),
+          genesis(createTx(-1, {})), pool(params.threads)
     {
         for (auto i = 0; i <= params.num_nodes; i++)
             nodes.push_back(std::make_shared<Node>(Node(i, params, this, genesis)));
+        inboxes.resize(nodes.size());
     }
 
-    void run()
+    void run();
+    void prune();
+    // estimated bytes held by the table and the nodes.
+    std::size_t memory() const;
+    // enforces params.memory_budget. Over it, with the policy
+    // "prune" and pruning off, turns pruning on, prunes and
+    // compacts the nodes at once and returns true; throws
+    // std::runtime_error if that is not enough, or otherwise.
+    bool checkMemory();
+
+    TxPtr const &createTx(int data, TxIndexes parents)
     {
-        for (auto &n : nodes)
-            n->avalancheLoop();
+        return table.create(uuids(), data, std::move(parents));
     }
 
     // private:
     Parameters params;
-    std::mt19937_64 rng;
-    Tx genesis; // genesis tx
+    std::mt19937_64 rng; // client simulation
+    UuidGenerator uuids;
+    TxTable table; // network-wide tx bodies
+    TxPtr genesis; // genesis tx
     std::vector<std::shared_ptr<Node>> nodes;
+    ThreadPool pool;
+    std::uint64_t ticks = 0; // calls to run, the clock of batch_timeout
+    TxIndex watermark = 0;   // lowest watermark of the nodes
     Network(Network const &) = delete;
     Network &operator=(Network const &) = delete;
+
+private:
+    // a query delivered to a peer: the sender and the slot of
+    // Node::Outbox::responses the answer goes to.
+    struct Message
+    {
+        int sender;
+        std::size_t slot;
+    };
+    std::vector<std::vector<Message>> inboxes;
 };
@@ -0,0 +1,201 @@
+#include <random>
+#include <memory>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "avalanche.hpp"
+#include "perf.hpp"
+
+using namespace std;
+
+// Microbenchmarks of the protocol hot paths.
+//
+// Every benchmark runs over a synthetic DAG described by its
+// arguments: number of transactions, width (transactions per layer)
+// and conflict ratio in percent (share of transactions spending the
+// data of an earlier one). Use --benchmark_format=json or
+// --benchmark_out=<file> to export the results.
+
+namespace {
+
+struct Dag {
+  Parameters params;
+  unique_ptr<Network> net;
+  vector<vector<TxPtr>> layers;
+
+  Dag(int size, int width, int conflicts, bool generic = false) {
+    params.num_nodes = 10;
+    params.k = 4;
+    params.generic_protocol = generic;
+    net = make_unique<Network>(params);
+
+    mt19937_64 rng(params.seed);
+    uniform_int_distribution<int> percent(0, 99);
+    auto &node = *net->nodes[0];
+    layers.push_back({net->genesis});
+    for (int i = 0; i < size;) {
+      auto &previous = layers.back();
+      vector<TxPtr> layer;
+      for (int w = 0; w < width && i < size; w++, i++) {
+        TxIndexes parents;
+        for (auto &p : previous)
+          if (parents.size() < size_t(params.max_parents) && rng() % 2)
+            parents.push_back(p->idx);
+        if (parents.empty())
+          parents.push_back(previous[rng() % previous.size()]->idx);
+        auto data = percent(rng) < conflicts && i > 0
+                        ? uniform_int_distribution<int>(0, i - 1)(rng)
+                        : i;
+        auto &tx = net->createTx(data, move(parents));
+        node.onReceiveTx(node, tx);
+        layer.push_back(tx);
+      }
+      layers.push_back(move(layer));
+      net->run();
+    }
+  }
+
+  Node &node() { return *net->nodes[0]; }
+
+  template <typename F>
+  void forEach(F f) {
+    for (auto &layer : layers)
+      for (auto &tx : layer)
+        f(tx);
+  }
+
+  size_t size() const { return net->table.size(); }
+};
+
+// DAGs are expensive to build and read-only for most benchmarks.
+Dag &dag(benchmark::State const &state) {
+  static map<tuple<int64_t, int64_t, int64_t>, unique_ptr<Dag>> cache;
+  auto key = make_tuple(state.range(0), state.range(1), state.range(2));
+  auto &d = cache[key];
+  if (!d)
+    d = make_unique<Dag>(state.range(0), state.range(1), state.range(2));
+  return *d;
+}
+
+// hardware counters of a benchmark, from its construction to the
+// end of the benchmark function, per iteration, leaving out what
+// runs between pause() and resume(), like PauseTiming; the counters
+// the kernel refuses are left out (see perf.hpp).
+class HwCounters {
+public:
+  explicit HwCounters(benchmark::State &state) : state(state), start(perf::read()) {}
+  ~HwCounters() {
+    pause();
+    auto available = perf::available();
+    for (int e = 0; e < perf::num_events; e++)
+      if (available[e])
+        state.counters[perf::names[e]] =
+            benchmark::Counter(double(total[e]), benchmark::Counter::kAvgIterations);
+  }
+
+  void pause() {
+    auto end = perf::read();
+    // scaled counts may step back by a little
+    for (int e = 0; e < perf::num_events; e++)
+      if (end[e] > start[e])
+        total[e] += end[e] - start[e];
+  }
+  void resume() { start = perf::read(); }
+
+private:
+  benchmark::State &state;
+  perf::Values start, total{};
+};
+
+void dagArgs(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"size", "width", "conflicts%"});
+  for (int size : {1000, 4000})
+    for (int width : {1, 8})
+      for (int conflicts : {0, 5})
+        b->Args({size, width, conflicts});
+}
+
+// a node that has never seen the DAG receives its last layer,
+// syncing every ancestor.
+void BM_onReceiveTx(benchmark::State &state) {
+  auto &d = dag(state);
+  HwCounters hw(state);
+  for (auto _ : state) {
+    Node fresh(d.params.num_nodes + 1, d.params, d.net.get(), d.net->genesis);
+    for (auto &tx : d.layers.back())
+      fresh.onReceiveTx(d.node(), tx);
+    benchmark::DoNotOptimize(fresh.knows(d.layers.back().front()->idx));
+  }
+  state.SetItemsProcessed(state.iterations() * d.size());
+}
+BENCHMARK(BM_onReceiveTx)->Apply(dagArgs);
+
+void BM_parentSet(benchmark::State &state) {
+  auto &d = dag(state);
+  HwCounters hw(state);
+  for (auto _ : state) {
+    size_t n = 0;
+    for (auto &tx : d.layers.back())
+      for (auto idx : d.node().parentSet(tx))
+        n += idx;
+    benchmark::DoNotOptimize(n);
+  }
+}
+BENCHMARK(BM_parentSet)->Apply(dagArgs);
+
+void BM_isStronglyPrefered(benchmark::State &state) {
+  auto &d = dag(state);
+  HwCounters hw(state);
+  for (auto _ : state)
+    d.forEach([&](auto &tx) { benchmark::DoNotOptimize(d.node().isStronglyPrefered(tx)); });
+  state.SetItemsProcessed(state.iterations() * d.size());
+}
+BENCHMARK(BM_isStronglyPrefered)->Apply(dagArgs);
+
+void BM_parentSelection(benchmark::State &state) {
+  auto &d = dag(state);
+  HwCounters hw(state);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(d.node().parentSelection());
+}
+BENCHMARK(BM_parentSelection)->Apply(dagArgs);
+
+// one new transaction to query on a node knowing the whole DAG,
+// with the vote path compiled for k = 4, α = 0.8 or generic.
+void BM_avalancheLoop(benchmark::State &state, bool generic) {
+  Dag d(state.range(0), state.range(1), state.range(2), generic);
+  int data = d.size();
+  HwCounters hw(state);
+  for (auto _ : state) {
+    state.PauseTiming();
+    hw.pause();
+    d.node().onGenerateTx(data++);
+    hw.resume();
+    state.ResumeTiming();
+    d.node().avalancheLoop();
+  }
+}
+BENCHMARK_CAPTURE(BM_avalancheLoop, fixed, false)->Apply(dagArgs);
+BENCHMARK_CAPTURE(BM_avalancheLoop, generic, true)->Apply(dagArgs);
+
+void BM_isAccepted(benchmark::State &state) {
+  auto &d = dag(state);
+  HwCounters hw(state);
+  for (auto _ : state)
+    d.forEach([&](auto &tx) { benchmark::DoNotOptimize(d.node().isAccepted(tx)); });
+  state.SetItemsProcessed(state.iterations() * d.size());
+}
+BENCHMARK(BM_isAccepted)->Apply(dagArgs);
+
+void BM_fractionAccepted(benchmark::State &state) {
+  auto &d = dag(state);
+  HwCounters hw(state);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(d.node().fractionAccepted());
+  state.SetItemsProcessed(state.iterations() * d.size());
+}
+BENCHMARK(BM_fractionAccepted)->Apply(dagArgs);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,20 @@
+# regression run of --prune: runs zks with ARGS with and without
+# pruning, which must print the same trace in tick mode.
+#   cmake -DZKS=path/to/zks -DARGS="-n;300;..." -P prune_run.cmake
+foreach(mode plain prune)
+    set(extra)
+    if (mode STREQUAL prune)
+        set(extra --prune)
+    endif()
+    execute_process(
+        COMMAND ${ZKS} ${ARGS} ${extra}
+        OUTPUT_VARIABLE out_${mode}
+        ERROR_VARIABLE err
+        RESULT_VARIABLE rc)
+    if (NOT rc EQUAL 0)
+        message(FATAL_ERROR "zks ${ARGS} ${extra} failed (${rc}): ${err}")
+    endif()
+endforeach()
+if (NOT out_plain STREQUAL out_prune)
+    message(FATAL_ERROR "zks ${ARGS} prints a different trace with --prune")
+endif()
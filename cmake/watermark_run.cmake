@@ -0,0 +1,27 @@
+# regression run of --prune: runs zks with ARGS, which must
+# include --prune and --memory-every, and checks that the
+# watermark printed with every memory report keeps advancing.
+#   cmake -DZKS=path/to/zks -DARGS="-n;8000;..." -P watermark_run.cmake
+execute_process(
+    COMMAND ${ZKS} ${ARGS}
+    OUTPUT_VARIABLE out
+    ERROR_VARIABLE err
+    RESULT_VARIABLE rc)
+if (NOT rc EQUAL 0)
+    message(FATAL_ERROR "zks ${ARGS} failed (${rc}): ${err}")
+endif()
+string(REGEX MATCHALL "pruned below [0-9]+" reports "${out}")
+# the last one is the report at the end of the run.
+list(REMOVE_AT reports -1)
+list(LENGTH reports n)
+if (n LESS 2)
+    message(FATAL_ERROR "zks ${ARGS} printed ${n} watermarks")
+endif()
+set(last -1)
+foreach(r ${reports})
+    string(REGEX REPLACE "pruned below " "" w "${r}")
+    if (NOT w GREATER last)
+        message(FATAL_ERROR "zks ${ARGS}: the watermark stopped at ${last}")
+    endif()
+    set(last ${w})
+endforeach()
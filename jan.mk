@@ -1,16 +1,47 @@
 CXX = clang++
-CXXFLAGS = -std=c++17 -g
+CXXFLAGS = -std=c++17 -g -pthread
+# CXXFLAGS += -DZKS_METRICS  # protocol counters and histograms, see metrics.hpp
+# CXXFLAGS += -DZKS_TRACE    # Chrome trace of the simulation phases, see trace.hpp
 all: zks.exe
 
-zks.exe: main.o avalanche.o
-	$(CXX) -o zks.exe main.o avalanche.o
+HEADERS = avalanche.hpp latency.hpp parameters.hpp random.hpp \
+	thread_pool.hpp txset.hpp
 
-main.o: main.cpp avalanche.hpp parameters.hpp
+OBJS = avalanche.o metrics.o perf.o runner.o simulation.o snapshot.o trace.o
+
+zks.exe: main.o $(OBJS)
+	$(CXX) -pthread -o zks.exe main.o $(OBJS)
+
+main.o: main.cpp metrics.hpp perf.hpp runner.hpp simulation.hpp snapshot.hpp timing_wheel.hpp trace.hpp $(HEADERS)
 	$(CXX) $(CXXFLAGS) -c main.cpp
 
-avalanche.o: avalanche.cpp avalanche.hpp
+avalanche.o: avalanche.cpp metrics.hpp perf.hpp trace.hpp $(HEADERS)
 	$(CXX) $(CXXFLAGS) -c avalanche.cpp
 
+simulation.o: simulation.cpp perf.hpp runner.hpp simulation.hpp timing_wheel.hpp trace.hpp $(HEADERS)
+	$(CXX) $(CXXFLAGS) -c simulation.cpp
+
+metrics.o: metrics.cpp metrics.hpp
+	$(CXX) $(CXXFLAGS) -c metrics.cpp
+
+perf.o: perf.cpp perf.hpp
+	$(CXX) $(CXXFLAGS) -c perf.cpp
+
+runner.o: runner.cpp runner.hpp snapshot.hpp $(HEADERS)
+	$(CXX) $(CXXFLAGS) -c runner.cpp
+
+snapshot.o: snapshot.cpp snapshot.hpp runner.hpp $(HEADERS)
+	$(CXX) $(CXXFLAGS) -c snapshot.cpp
+
+zks_bench.exe: bench.o $(OBJS)
+	$(CXX) -pthread -o zks_bench.exe bench.o $(OBJS) -lbenchmark
+
+bench.o: bench.cpp perf.hpp $(HEADERS)
+	$(CXX) $(CXXFLAGS) -O2 -c bench.cpp
+
+trace.o: trace.cpp trace.hpp
+	$(CXX) $(CXXFLAGS) -c trace.cpp
+
 clean:
-	$(RM) *.o zks.exe
+	$(RM) *.o zks.exe zks_bench.exe
 
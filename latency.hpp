@@ -0,0 +1,100 @@
+#pragma once
+#include <cmath>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+
+// simulated time, in microseconds.
+using SimTime = std::uint64_t;
+
+// A latency distribution, given in milliseconds as
+//   const:X            always X
+//   uniform:A:B        uniform in [A, B]
+//   exp:MEAN           exponential with the given mean
+//   lognormal:MED:SIG  log-normal with median MED, log-space sigma SIG
+class Latency
+{
+public:
+    Latency() = default;
+
+    static Latency parse(std::string const &spec)
+    {
+        std::istringstream ss(spec);
+        std::string kind;
+        std::getline(ss, kind, ':');
+        std::vector<double> args;
+        for (std::string arg; std::getline(ss, arg, ':');)
+        {
+            std::size_t pos = 0;
+            double v = -1;
+            try
+            {
+                v = std::stod(arg, &pos);
+            }
+            catch (std::logic_error const &)
+            {
+                pos = 0;
+            }
+            if (arg.empty() || pos != arg.size() || v < 0)
+                throw std::invalid_argument("bad latency argument in `" + spec + "`");
+            args.push_back(v);
+        }
+        // getline drops an empty last field.
+        if (!spec.empty() && spec.back() == ':')
+            throw std::invalid_argument("bad latency argument in `" + spec + "`");
+
+        Latency l;
+        if (kind == "const" && args.size() == 1)
+            l.kind = Constant;
+        else if (kind == "uniform" && args.size() == 2 && args[0] <= args[1])
+            l.kind = Uniform;
+        else if (kind == "exp" && args.size() == 1)
+            l.kind = Exponential;
+        else if (kind == "lognormal" && args.size() == 2 && args[0] > 0)
+            l.kind = LogNormal;
+        else
+            throw std::invalid_argument("bad latency distribution `" + spec + "`");
+        l.a = args[0];
+        l.b = args.size() > 1 ? args[1] : 0;
+        l.spec = spec;
+        return l;
+    }
+
+    template <typename Rng>
+    SimTime operator()(Rng &rng) const
+    {
+        double ms = 0;
+        switch (kind)
+        {
+        case Constant:
+            ms = a;
+            break;
+        case Uniform:
+            ms = std::uniform_real_distribution<double>(a, b)(rng);
+            break;
+        case Exponential:
+            ms = a > 0 ? std::exponential_distribution<double>(1 / a)(rng) : 0;
+            break;
+        case LogNormal:
+            ms = std::lognormal_distribution<double>(std::log(a), b)(rng);
+            break;
+        }
+        return SimTime(std::llround(ms * 1000));
+    }
+
+    std::string const &to_string() const { return spec; }
+
+private:
+    enum Kind
+    {
+        Constant,
+        Uniform,
+        Exponential,
+        LogNormal
+    } kind = Constant;
+    double a = 0, b = 0;
+    std::string spec = "const:0";
+};
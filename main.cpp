@@ -5,6 +5,12 @@
 
 #include "cxxopts.hpp"
 #include "avalanche.hpp"
+#include "metrics.hpp"
+#include "perf.hpp"
+#include "trace.hpp"
+#include "runner.hpp"
+#include "simulation.hpp"
+#include "snapshot.hpp"
 
 using namespace std;
 
@@ -14,79 +20,136 @@ int main(int argc, char **argv)
 {
    Parameters p = parse_options(argc, argv);
 
-   Network net(p);
-
-   auto &n1 = net.nodes[0];
-   uniform_real_distribution<double> next_double(0.0, 1.0);
-   TxSet c1, c2;
-
-   // simulate a client
-   for (auto i = 0; i < p.num_transactions; i++)
+#ifdef ZKS_METRICS
+   // dumps the metrics when main returns, whatever the mode.
+   struct DumpMetrics
+   {
+      string path;
+      ~DumpMetrics()
+      {
+         try
+         {
+            metrics::dump(path);
+         }
+         catch (const runtime_error &e)
+         {
+            cout << "error: " << e.what() << endl;
+         }
+      }
+   } dump_metrics{p.metrics};
+#endif
+#ifdef ZKS_TRACE
+   // writes the trace when main returns, whatever the mode.
+   struct WriteTrace
    {
+      string path;
+      ~WriteTrace()
+      {
+         if (path.empty())
+            return;
+         try
+         {
+            trace::write(path);
+         }
+         catch (const runtime_error &e)
+         {
+            cout << "error: " << e.what() << endl;
+         }
+      }
+   } write_trace{p.trace};
+   if (!p.trace.empty())
+      trace::start();
+#endif
 
-      // pic a random node.
-      std::uniform_int_distribution<int> dist(0, net.nodes.size() - 1);
-      auto &n = net.nodes[dist(net.rng)];
-      // auto &n = net.nodes[N[i % N.size()]];
+   // reports the hardware counters when main returns, whatever the mode.
+   struct ReportPerf
+   {
+      bool on;
+      ~ReportPerf()
+      {
+         if (on)
+            perf::report(cout);
+      }
+   } report_perf{p.perf};
+   if (p.perf)
+      perf::enable();
 
-      // send a transaction
-      c1.insert(n->onGenerateTx(i));
+   if (!p.sweep.empty())
+   {
+      sweep(p, cout);
+      return 0;
+   }
+   if (p.ensemble)
+   {
+      ensemble(p, cout);
+      return 0;
+   }
 
-      if (next_double(net.rng) < p.double_spend_ratio)
+   // resuming: the network is built with the parameters of the
+   // snapshot, then overwritten with its state.
+   unique_ptr<Snapshot> snap;
+   try
+   {
+      if (!p.resume.empty())
       {
-         // generate a double spend
-         auto d = uniform_int_distribution<int>(0, i)(net.rng);
-         cout << "double spend of " << d << endl;
-         auto nodes = net.nodes;
-         shuffle(nodes.begin(), nodes.end(), net.rng);
-         auto &n2 = nodes.front();
-         c2.insert(n2->onGenerateTx(d));
+         snap = make_unique<Snapshot>(p.resume);
+         p = snap->parameters(p);
       }
+   }
+   catch (const runtime_error &e)
+   {
+      cout << "error: " << e.what() << endl;
+      return 1;
+   }
 
-      net.run();
+   Network net(p);
+   ClientState client;
+   try
+   {
+      if (snap)
+         snap->restore(net, client);
+   }
+   catch (const runtime_error &e)
+   {
+      cout << "error: " << e.what() << endl;
+      return 1;
+   }
+   snap.reset();
 
-      if (p.dump_dags)
+   try
+   {
+      if (p.engine == "event")
       {
-         ostringstream ss;
-         ss << boost::format("znode-0-%03d.dot") % i;
-         n1->dumpDag(ss.str());
+         EventSimulation sim(net, client.c1, client.c2);
+         sim.run();
+         sim.report(cout);
       }
-      cout << i << ":  " << n1->fractionAccepted() << endl;
+      else
+         runTicks(net, client, &cout);
    }
+   catch (const runtime_error &e)
+   {
+      cout << "error: " << e.what() << endl;
+      reportMemory(cout, net, true);
+      return 1;
+   }
+   if (p.memory_budget || p.memory_every)
+      reportMemory(cout, net, true);
 
    // we check that either one or none of two
    // conflicting transactions have been accepted,
    // but not both! (double spending).
-   map<int, vector<TxPtr>> conflict_sets;
-   for (auto &t : c1)
-      conflict_sets[t->data].push_back(t);
-   for (auto &t : c2)
-      conflict_sets[t->data].push_back(t);
-   for (auto &[v, l] : conflict_sets)
-      if (l.size() == 2)
-      {
-         auto tx1_anynode{[&, l = l]() {
-            for (auto &n : net.nodes)
-               if (n->isAccepted(l[0]))
-                  return true;
-            return false;
-         }()};
-         auto tx2_anynode{[&, l = l]() {
-            for (auto &n : net.nodes)
-               if (n->isAccepted(l[1]))
-                  return true;
-            return false;
-         }()};
-         assert(!(tx1_anynode && tx2_anynode));
-         cout << "double spend: data=" << v << " Txs = ";
-         if (tx1_anynode)
-            cout << "[" << l[0]->strid << "] ";
-         else
-            cout << l[0]->strid;
-         if (tx2_anynode)
-            cout << " [" << l[1]->strid << "]";
-         else
-            cout << l[1]->strid;
-         cout << endl;
-      }
+   forEachDoubleSpend(net, client, [](int v, auto &tx1, auto &tx2, bool tx1_anynode, bool tx2_anynode) {
+      assert(!(tx1_anynode && tx2_anynode));
+      cout << "double spend: data=" << v << " Txs = ";
+      if (tx1_anynode)
+         cout << "[" << tx1->strid() << "] ";
+      else
+         cout << tx1->strid();
+      if (tx2_anynode)
+         cout << " [" << tx2->strid() << "]";
+      else
+         cout << tx2->strid();
+      cout << endl;
+   });
 }
@@ -0,0 +1,92 @@
+#include "metrics.hpp"
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <boost/format.hpp>
+
+using namespace std;
+
+#ifdef ZKS_METRICS
+namespace metrics {
+
+void Hdr::merge(Hdr const &h) {
+  for (int b = 0; b < buckets; b++)
+    counts[b] += h.counts[b];
+  n += h.n;
+  sum += h.sum;
+  min = std::min(min, h.min);
+  max = std::max(max, h.max);
+}
+
+uint64_t Hdr::quantile(double q) const {
+  uint64_t seen = 0, rank = uint64_t(q * n);
+  for (int b = 0; b < buckets; b++)
+    if ((seen += counts[b]) > rank)
+      return lowest(b);
+  return max;
+}
+
+namespace {
+const char *counter_names[num_counters] = {
+    "queries",      "vertices",       "queried_txs",   "received_txs",
+    "fetched_txs",  "accepted_beta1", "accepted_beta2"};
+const char *histogram_names[num_histograms] = {
+    "vertex_size",   "fetches_per_receive", "closure_size",
+    "eligible_size", "frontier_size",       "conflict_set_size"};
+
+// the registries of every thread that recorded, kept after the
+// thread exits.
+mutex m;
+vector<unique_ptr<Registry>> registries;
+} // namespace
+
+Registry &local() {
+  thread_local Registry *r = [] {
+    lock_guard<mutex> lock(m);
+    registries.push_back(make_unique<Registry>());
+    return registries.back().get();
+  }();
+  return *r;
+}
+
+void dump(string const &path) {
+  Registry total;
+  {
+    lock_guard<mutex> lock(m);
+    for (auto &r : registries) {
+      for (int c = 0; c < num_counters; c++)
+        total.counters[c] += r->counters[c];
+      for (int h = 0; h < num_histograms; h++)
+        total.histograms[h].merge(r->histograms[h]);
+    }
+  }
+
+  ofstream out(path);
+  out << "{\n  \"counters\": {";
+  for (int c = 0; c < num_counters; c++)
+    out << (c ? "," : "") << "\n    \"" << counter_names[c] << "\": " << total.counters[c];
+  out << "\n  },\n  \"histograms\": {";
+  for (int i = 0; i < num_histograms; i++) {
+    auto &h = total.histograms[i];
+    out << (i ? "," : "") << "\n    \"" << histogram_names[i] << "\": {";
+    out << boost::format("\"count\": %d, \"sum\": %d, \"min\": %d, \"max\": %d, \"mean\": %g, "
+                         "\"p50\": %d, \"p90\": %d, \"p99\": %d, \"p999\": %d, \"buckets\": [") %
+               h.n % h.sum % (h.n ? h.min : 0) % h.max % (h.n ? double(h.sum) / h.n : 0.0) %
+               h.quantile(0.5) % h.quantile(0.9) % h.quantile(0.99) % h.quantile(0.999);
+    // non-empty buckets, as [lowest value, count]
+    bool first = true;
+    for (int b = 0; b < Hdr::buckets; b++)
+      if (h.counts[b]) {
+        out << (first ? "" : ", ") << "[" << Hdr::lowest(b) << ", " << h.counts[b] << "]";
+        first = false;
+      }
+    out << "]}";
+  }
+  out << "\n  }\n}\n";
+  if (!out)
+    throw runtime_error("cannot write metrics to " + path);
+}
+} // namespace metrics
+#endif
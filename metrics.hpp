@@ -0,0 +1,106 @@
+#pragma once
+#include <array>
+#include <algorithm>
+#include <string>
+#include <cstdint>
+
+// Counters and histograms of the protocol internals.
+//
+// Compiled in with ZKS_METRICS defined (cmake -DZKS_METRICS=ON);
+// otherwise ZKS_COUNT and ZKS_RECORD expand to nothing and their
+// arguments are not evaluated. Every thread records into its own
+// registry, without synchronization; the registries are summed
+// when dumped, once the simulation threads are done.
+namespace metrics
+{
+enum Counter
+{
+    queries,          // peers queried, one per vertex and peer
+    vertices,         // vertices queried
+    queried_txs,      // transactions queried
+    received_txs,     // transactions inserted by onReceiveTx
+    fetched_txs,      // of them, missing ancestors fetched
+    accepted_beta1,   // accepted by the safe early commitment
+    accepted_beta2,   // accepted by the consecutive counter
+    num_counters
+};
+
+enum Histogram
+{
+    vertex_size,         // transactions per vertex
+    fetches_per_receive, // missing ancestors per new transaction
+    closure_size,        // ancestors returned by parentSet
+    eligible_size,       // |E′| in parentSelection
+    frontier_size,       // tips of E′ in parentSelection
+    conflict_set_size,   // size of the set a new transaction joins
+    num_histograms
+};
+
+// HDR-style histogram: exact below 128, then 64 linear
+// sub-buckets per power of two, i.e. within 1.6%.
+class Hdr
+{
+public:
+    static constexpr int sub_bits = 6;
+    static constexpr int buckets = (65 - sub_bits) << sub_bits;
+
+    static int bucket(std::uint64_t v)
+    {
+        if (v < (2u << sub_bits))
+            return int(v);
+        int shift = 63 - __builtin_clzll(v) - sub_bits;
+        return (shift << sub_bits) + int(v >> shift);
+    }
+
+    // lowest value of bucket b
+    static std::uint64_t lowest(int b)
+    {
+        if (b < (2 << sub_bits))
+            return std::uint64_t(b);
+        int shift = (b >> sub_bits) - 1;
+        return std::uint64_t(b - (shift << sub_bits)) << shift;
+    }
+
+    void record(std::uint64_t v)
+    {
+        counts[bucket(v)]++;
+        n++;
+        sum += v;
+        min = std::min(min, v);
+        max = std::max(max, v);
+    }
+
+    void merge(Hdr const &h);
+    // lowest value of the bucket holding quantile q
+    std::uint64_t quantile(double q) const;
+
+    std::array<std::uint64_t, buckets> counts{};
+    std::uint64_t n = 0, sum = 0, min = ~std::uint64_t(0), max = 0;
+};
+
+struct Registry
+{
+    std::array<std::uint64_t, num_counters> counters{};
+    std::array<Hdr, num_histograms> histograms;
+};
+
+#ifdef ZKS_METRICS
+// the calling thread's registry
+Registry &local();
+
+inline void count(Counter c, std::uint64_t n) { local().counters[c] += n; }
+inline void record(Histogram h, std::uint64_t v) { local().histograms[h].record(v); }
+
+// sums the registries of every thread and writes them to `path`
+// as JSON.
+void dump(std::string const &path);
+#endif
+} // namespace metrics
+
+#ifdef ZKS_METRICS
+#define ZKS_COUNT(c, n) ::metrics::count(::metrics::c, (n))
+#define ZKS_RECORD(h, v) ::metrics::record(::metrics::h, (v))
+#else
+#define ZKS_COUNT(c, n) ((void)0)
+#define ZKS_RECORD(h, v) ((void)0)
+#endif
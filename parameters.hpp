@@ -1,5 +1,11 @@
 #pragma once
+#include <cmath>
+#include <climits>
+#include <sstream>
+#include <utility>
+#include <vector>
 #include "cxxopts.hpp"
+#include "latency.hpp"
 //
 //
 struct Parameters
@@ -11,7 +17,38 @@ struct Parameters
     int k = 1 + num_nodes / 10;
     int beta1 = 5;
     int beta2 = 5;
+    int max_parents = 4;
+    int batch_size = 1;
+    int batch_timeout = 0;
     unsigned long seed = 12345L;
+    int threads = 1;
+    std::string engine = "tick";
+    Latency latency = Latency::parse("exp:50");
+    Latency client_latency = Latency::parse("const:10");
+    Latency tx_interval = Latency::parse("exp:100");
+    bool prune = false;
+    // run the vote path with the runtime protocol constants even
+    // for a configuration it is compiled for (see Node::dispatch).
+    bool generic_protocol = false;
+    int checkpoint_every = 0;
+    std::string checkpoint = "zks.snapshot";
+    std::string resume;
+    // sweep: grid of values of alpha, k, beta1, beta2 and
+    // double-spend-ratio, see sweep() in runner.hpp.
+    std::vector<std::pair<std::string, std::vector<double>>> sweep;
+    // ensemble: number of independent runs, see ensemble() in
+    // runner.hpp, stopped once the precision is reached (0: never).
+    int ensemble = 0;
+    double precision = 0;
+    std::string metrics = "zks.metrics.json"; // with ZKS_METRICS
+    std::string trace;                         // with ZKS_TRACE
+    bool perf = false;
+    // memory_budget: estimated bytes of the network (0: none), see
+    // Network::checkMemory; memory_every: report period, in
+    // transactions (0: never).
+    std::size_t memory_budget = 0;
+    std::string memory_policy = "prune";
+    int memory_every = 0;
     bool dump_dags = false;
     bool verbose = false;
 };
@@ -27,11 +64,37 @@ parse_options(int argc, char *argv[])
         options.add_options()("a,alpha", "The alpha parameter", cxxopts::value<double>()->default_value("0.8"));
         options.add_options()("beta1", "The beta1 parameter", cxxopts::value<int>()->default_value("5"));
         options.add_options()("beta2", "The beta2 parameter", cxxopts::value<int>()->default_value("5"));
+        options.add_options()("max-parents", "The maximum number of parents of a new tx", cxxopts::value<int>()->default_value("4"));
+        options.add_options()("batch-size", "number of transactions queried together as a vertex (1 to 64)", cxxopts::value<int>()->default_value("1"));
+        options.add_options()("batch-timeout", "how long an incomplete vertex waits for transactions, in ticks or ms for the event engine", cxxopts::value<int>()->default_value("0"));
         options.add_options()("d,double-spend-ratio", "The double spend ratio", cxxopts::value<double>()->default_value("0.02"));
         options.add_options()("k,sample-size", "The sample size (default `1 + nrNodes / 10`)", cxxopts::value<int>());
         options.add_options()("n,num-transactions", "nunber of tx to generate", cxxopts::value<int>()->default_value("20"));
         options.add_options()("num-nodes", "number of nodes to simulate", cxxopts::value<int>()->default_value("50"));
         options.add_options()("seed", "seed random generation", cxxopts::value<int>()->default_value("12345"));
+        options.add_options()("threads", "number of threads running the nodes, or the runs of a sweep or an ensemble (0: one per core, the default for these)", cxxopts::value<int>()->default_value("1"));
+        options.add_options()("engine", "simulation engine: `tick` (lock-step) or `event` (discrete events)", cxxopts::value<std::string>()->default_value("tick"));
+        options.add_options()("latency", "message latency distribution in ms, for the event engine", cxxopts::value<std::string>()->default_value("exp:50"));
+        options.add_options()("client-latency", "client to node latency distribution in ms, for the event engine", cxxopts::value<std::string>()->default_value("const:10"));
+        options.add_options()("tx-interval", "distribution of the time between two client tx in ms, for the event engine", cxxopts::value<std::string>()->default_value("exp:100"));
+        options.add_options()("prune", "forget the decided history below the accepted frontier", cxxopts::value<bool>(p.prune));
+        options.add_options()("checkpoint-every", "save a snapshot every N transactions, for the tick engine (0: never)", cxxopts::value<int>()->default_value("0"));
+        options.add_options()("checkpoint", "snapshot file written by --checkpoint-every", cxxopts::value<std::string>()->default_value("zks.snapshot"));
+        options.add_options()("resume", "resume the run saved in a snapshot file", cxxopts::value<std::string>());
+        options.add_options()("sweep", "run the grid of parameters `name=v1,v2,...;name=...` (alpha, k, beta1, beta2, double-spend-ratio) concurrently and print one table", cxxopts::value<std::string>());
+        options.add_options()("ensemble", "run up to N independent seeds and estimate the double spend outcome probabilities", cxxopts::value<int>());
+        options.add_options()("precision", "stop the ensemble once the 95% interval of the share of runs with a double spend accepted twice is within +/- this", cxxopts::value<double>()->default_value("0"));
+#ifdef ZKS_METRICS
+        options.add_options()("metrics", "file the counters and histograms are written to at exit", cxxopts::value<std::string>()->default_value("zks.metrics.json"));
+#endif
+#ifdef ZKS_TRACE
+        options.add_options()("trace", "record the simulation phases and write them to this file as a Chrome trace", cxxopts::value<std::string>());
+#endif
+        options.add_options()("perf", "count cycles, instructions, cache, branch and TLB misses per protocol phase", cxxopts::value<bool>(p.perf));
+        options.add_options()("memory-budget", "memory the network may use, in MB (0: no limit)", cxxopts::value<int>()->default_value("0"));
+        options.add_options()("memory-policy", "over the budget: `prune` (turn pruning on, then fail) or `fail`", cxxopts::value<std::string>()->default_value("prune"));
+        options.add_options()("memory-every", "report the memory used every N transactions (0: never)", cxxopts::value<int>()->default_value("0"));
+        options.add_options()("generic-protocol", "use the runtime alpha, k, beta1 and beta2 even for a configuration the vote path is compiled for", cxxopts::value<bool>(p.generic_protocol));
         options.add_options()("dump-dags", "dump dags in dot format", cxxopts::value<bool>(p.dump_dags));
 
         auto result = options.parse(argc, argv);
@@ -47,6 +110,27 @@ parse_options(int argc, char *argv[])
             p.beta1 = result["beta1"].as<int>();
         if (result.count("beta2"))
             p.beta2 = result["beta2"].as<int>();
+        if (result.count("max-parents"))
+            p.max_parents = result["max-parents"].as<int>();
+        if (p.max_parents < 1)
+        {
+            std::cout << "error parsing options: max-parents must be positive" << std::endl;
+            exit(1);
+        }
+        if (result.count("batch-size"))
+            p.batch_size = result["batch-size"].as<int>();
+        if (p.batch_size < 1 || p.batch_size > 64)
+        {
+            std::cout << "error parsing options: batch-size must be between 1 and 64" << std::endl;
+            exit(1);
+        }
+        if (result.count("batch-timeout"))
+            p.batch_timeout = result["batch-timeout"].as<int>();
+        if (p.batch_timeout < 0)
+        {
+            std::cout << "error parsing options: batch-timeout must not be negative" << std::endl;
+            exit(1);
+        }
         if (result.count("double-spend-ratio"))
             p.double_spend_ratio = result["double-spend-ratio"].as<double>();
         if (result.count("num-nodes"))
@@ -59,6 +143,151 @@ parse_options(int argc, char *argv[])
             p.num_transactions = result["num-transactions"].as<int>();
         if (result.count("seed"))
             p.seed = result["seed"].as<int>();
+        if (result.count("threads"))
+            p.threads = result["threads"].as<int>();
+        if (p.threads < 0)
+        {
+            std::cout << "error parsing options: threads must not be negative" << std::endl;
+            exit(1);
+        }
+        if (result.count("engine"))
+            p.engine = result["engine"].as<std::string>();
+        if (p.engine != "tick" && p.engine != "event")
+        {
+            std::cout << "error parsing options: unknown engine " << p.engine << std::endl;
+            exit(1);
+        }
+        if (result.count("latency"))
+            p.latency = Latency::parse(result["latency"].as<std::string>());
+        if (result.count("client-latency"))
+            p.client_latency = Latency::parse(result["client-latency"].as<std::string>());
+        if (result.count("tx-interval"))
+            p.tx_interval = Latency::parse(result["tx-interval"].as<std::string>());
+        if (result.count("prune"))
+            p.prune = true;
+        if (result.count("checkpoint-every"))
+            p.checkpoint_every = result["checkpoint-every"].as<int>();
+        if (p.checkpoint_every < 0)
+        {
+            std::cout << "error parsing options: checkpoint-every must not be negative" << std::endl;
+            exit(1);
+        }
+        if (result.count("checkpoint"))
+            p.checkpoint = result["checkpoint"].as<std::string>();
+        if (result.count("resume"))
+            p.resume = result["resume"].as<std::string>();
+        // the snapshot holds the parameters that shape the network
+        // (see Snapshot::parameters): they cannot be changed.
+        if (!p.resume.empty())
+            for (auto name : {"alpha", "beta1", "beta2", "max-parents", "batch-size", "batch-timeout",
+                              "double-spend-ratio", "sample-size", "num-nodes", "seed", "prune"})
+                if (result.count(name))
+                {
+                    std::cout << "error parsing options: --" << name
+                              << " is taken from the snapshot when resuming" << std::endl;
+                    exit(1);
+                }
+        if (p.engine == "event" && (p.checkpoint_every || !p.resume.empty()))
+        {
+            std::cout << "error parsing options: snapshots are only supported by the tick engine" << std::endl;
+            exit(1);
+        }
+        if (result.count("sweep"))
+        {
+            std::istringstream grid(result["sweep"].as<std::string>());
+            for (std::string axis; std::getline(grid, axis, ';');)
+            {
+                auto eq = axis.find('=');
+                auto name = axis.substr(0, eq);
+                if (eq == std::string::npos ||
+                    (name != "alpha" && name != "k" && name != "beta1" && name != "beta2" &&
+                     name != "double-spend-ratio"))
+                    throw std::invalid_argument("bad sweep axis " + axis);
+                std::vector<double> values;
+                std::istringstream list(axis.substr(eq + 1));
+                for (std::string v; std::getline(list, v, ',');)
+                {
+                    std::size_t pos = 0;
+                    double x = 0;
+                    try
+                    {
+                        x = std::stod(v, &pos);
+                    }
+                    catch (std::logic_error const &)
+                    {
+                        pos = std::string::npos;
+                    }
+                    // k, beta1 and beta2 are counts, k at least 1.
+                    auto integral = name == "k" || name == "beta1" || name == "beta2";
+                    auto least = name == "k" ? 1 : 0;
+                    if (pos != v.size() ||
+                        (integral && (x != std::floor(x) || x < least || x > INT_MAX)))
+                        throw std::invalid_argument("bad value " + v + " for sweep axis " + name);
+                    values.push_back(x);
+                }
+                if (values.empty())
+                    throw std::invalid_argument("no value for sweep axis " + name);
+                p.sweep.push_back({name, values});
+            }
+            if (p.engine == "event" || !p.resume.empty())
+            {
+                std::cout << "error parsing options: sweep runs the tick engine from scratch" << std::endl;
+                exit(1);
+            }
+        }
+        if (result.count("ensemble"))
+            p.ensemble = result["ensemble"].as<int>();
+        if (result.count("precision"))
+            p.precision = result["precision"].as<double>();
+        if (p.ensemble < 0 || p.precision < 0)
+        {
+            std::cout << "error parsing options: ensemble and precision must not be negative" << std::endl;
+            exit(1);
+        }
+        if (p.ensemble && (p.engine == "event" || !p.resume.empty() || !p.sweep.empty()))
+        {
+            std::cout << "error parsing options: ensemble runs the tick engine from scratch" << std::endl;
+            exit(1);
+        }
+        // independent runs: their results do not depend on the
+        // number of threads, so sweeps and ensembles use every core
+        // by default.
+        if (!result.count("threads") && (!p.sweep.empty() || p.ensemble))
+            p.threads = 0;
+#ifdef ZKS_METRICS
+        if (result.count("metrics"))
+            p.metrics = result["metrics"].as<std::string>();
+#endif
+#ifdef ZKS_TRACE
+        if (result.count("trace"))
+            p.trace = result["trace"].as<std::string>();
+#endif
+        if (result.count("perf"))
+            p.perf = true;
+        if (result.count("memory-budget"))
+        {
+            auto mb = result["memory-budget"].as<int>();
+            if (mb < 0)
+            {
+                std::cout << "error parsing options: memory-budget must not be negative" << std::endl;
+                exit(1);
+            }
+            p.memory_budget = std::size_t(mb) << 20;
+        }
+        if (result.count("memory-policy"))
+            p.memory_policy = result["memory-policy"].as<std::string>();
+        if (p.memory_policy != "prune" && p.memory_policy != "fail")
+        {
+            std::cout << "error parsing options: unknown memory policy " << p.memory_policy << std::endl;
+            exit(1);
+        }
+        if (result.count("memory-every"))
+            p.memory_every = result["memory-every"].as<int>();
+        if (p.memory_every < 0)
+        {
+            std::cout << "error parsing options: memory-every must not be negative" << std::endl;
+            exit(1);
+        }
         if (result.count("dump-dags"))
             p.dump_dags = true;
     }
@@ -67,5 +296,10 @@ parse_options(int argc, char *argv[])
         std::cout << "error parsing options: " << e.what() << std::endl;
         exit(1);
     }
+    catch (const std::logic_error &e)
+    {
+        std::cout << "error parsing options: " << e.what() << std::endl;
+        exit(1);
+    }
     return p;
 }
\ No newline at end of file
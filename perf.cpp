@@ -0,0 +1,230 @@
+#include "perf.hpp"
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <ostream>
+#include <boost/format.hpp>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+using namespace std;
+
+namespace perf {
+
+char const *const names[num_events] = {"cycles", "instructions", "llc_misses", "branch_misses",
+                                       "dtlb_misses"};
+
+bool enabled = false;
+
+void enable() { enabled = true; }
+
+namespace {
+
+// the first error of perf_event_open, for the report.
+mutex m;
+int first_error = 0;
+
+// the counter group of a thread, closed when it exits.
+class Counters {
+public:
+  Counters() {
+#ifdef __linux__
+    for (int e = 0; e < num_events; e++) {
+      perf_event_attr a;
+      memset(&a, 0, sizeof a);
+      a.size = sizeof a;
+      a.exclude_kernel = 1;
+      a.exclude_hv = 1;
+      a.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                      PERF_FORMAT_TOTAL_TIME_RUNNING;
+      switch (Event(e)) {
+      case cycles:
+        a.type = PERF_TYPE_HARDWARE, a.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+      case instructions:
+        a.type = PERF_TYPE_HARDWARE, a.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+      case llc_misses:
+        a.type = PERF_TYPE_HARDWARE, a.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+      case branch_misses:
+        a.type = PERF_TYPE_HARDWARE, a.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+      default:
+        a.type = PERF_TYPE_HW_CACHE;
+        a.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      }
+      int fd = int(syscall(SYS_perf_event_open, &a, 0, -1, leader, 0));
+      if (fd < 0) {
+        lock_guard<mutex> lock(m);
+        if (!first_error)
+          first_error = errno;
+        continue;
+      }
+      if (leader < 0)
+        leader = fd;
+      slot[e] = n++;
+      fds.push_back(fd);
+    }
+#endif
+  }
+
+  ~Counters() {
+#ifdef __linux__
+    for (auto fd : fds)
+      close(fd);
+#endif
+  }
+
+  Values read() const {
+    Values rc{};
+#ifdef __linux__
+    // nr, time enabled, time running, then the values in the
+    // order of the group.
+    uint64_t buf[3 + num_events];
+    if (leader < 0 || ::read(leader, buf, sizeof buf) < ssize_t((3 + n) * sizeof(uint64_t)))
+      return rc;
+    // a group the PMU never scheduled counted nothing: unavailable,
+    // not 0. one multiplexed with other groups is extrapolated to the
+    // whole time it was enabled, as perf stat does.
+    if (!buf[2])
+      return rc;
+    scheduled = true;
+    double scale = buf[2] < buf[1] ? double(buf[1]) / buf[2] : 1.0;
+    for (int e = 0; e < num_events; e++)
+      if (slot[e] >= 0)
+        rc[e] = uint64_t(buf[3 + slot[e]] * scale);
+#endif
+    return rc;
+  }
+
+  array<int, num_events> slot{-1, -1, -1, -1, -1};
+  // whether a read found the group running at least once
+  mutable bool scheduled = false;
+
+private:
+  int leader = -1, n = 0;
+  vector<int> fds;
+};
+
+Counters &counters() {
+  thread_local Counters c;
+  return c;
+}
+
+// the counts of the phases of a thread, kept after it exits.
+struct Totals {
+  array<Values, num_phases> counts{};
+  array<uint64_t, num_phases> units{}, calls{};
+  array<bool, num_events> available{};
+};
+vector<unique_ptr<Totals>> totals;
+
+Totals &local() {
+  thread_local Totals *t = [] {
+    lock_guard<mutex> lock(m);
+    totals.push_back(make_unique<Totals>());
+    return totals.back().get();
+  }();
+  return *t;
+}
+
+} // namespace
+
+Values read() { return counters().read(); }
+
+array<bool, num_events> available() {
+  array<bool, num_events> rc;
+  for (int e = 0; e < num_events; e++)
+    rc[e] = counters().slot[e] >= 0 && counters().scheduled;
+  return rc;
+}
+
+Scope::~Scope() {
+  if (phase < 0)
+    return;
+  auto end = read();
+  auto &t = local();
+  // scaled counts may step back by a little
+  for (int e = 0; e < num_events; e++)
+    if (end[e] > start[e])
+      t.counts[phase][e] += end[e] - start[e];
+  t.units[phase] += units;
+  t.calls[phase]++;
+  // the group may be scheduled only after a few reads
+  auto a = available();
+  if (a != t.available) {
+    lock_guard<mutex> lock(m);
+    t.available = a;
+  }
+}
+
+void report(ostream &out) {
+  static char const *phase_names[num_phases] = {"generate", "prepare", "query", "apply",
+                                                "prune"};
+  static char const *unit_names[num_phases] = {"tx", "node round", "query", "node round",
+                                               "node round"};
+  Totals sum;
+  {
+    lock_guard<mutex> lock(m);
+    for (auto &t : totals) {
+      for (int p = 0; p < num_phases; p++) {
+        for (int e = 0; e < num_events; e++)
+          sum.counts[p][e] += t->counts[p][e];
+        sum.units[p] += t->units[p];
+        sum.calls[p] += t->calls[p];
+      }
+      for (int e = 0; e < num_events; e++)
+        sum.available[e] = sum.available[e] || t->available[e];
+    }
+  }
+
+  if (none_of(sum.available.begin(), sum.available.end(), [](bool a) { return a; })) {
+    out << "hardware counters unavailable";
+    if (first_error)
+      out << ": " << strerror(first_error);
+    else
+      out << ": never scheduled";
+    out << endl;
+    return;
+  }
+
+  out << "hardware counters, user space, per unit:" << endl;
+  out << boost::format("%-12s %-10s %10s") % "phase" % "unit" % "units";
+  for (int e = 0; e < num_events; e++)
+    out << boost::format(" %14s") % names[e];
+  out << boost::format(" %6s") % "IPC" << endl;
+
+  auto row = [&](string const &phase, string const &unit, uint64_t units, Values const &v) {
+    out << boost::format("%-12s %-10s %10d") % phase % unit % units;
+    for (int e = 0; e < num_events; e++)
+      if (sum.available[e])
+        out << boost::format(" %14.1f") % (units ? double(v[e]) / units : 0.0);
+      else
+        out << boost::format(" %14s") % "n/a";
+    if (sum.available[cycles] && sum.available[instructions] && v[cycles])
+      out << boost::format(" %6.2f") % (double(v[instructions]) / v[cycles]);
+    out << endl;
+  };
+
+  Values all{};
+  for (int p = 0; p < num_phases; p++) {
+    if (sum.calls[p])
+      row(phase_names[p], unit_names[p], sum.units[p], sum.counts[p]);
+    for (int e = 0; e < num_events; e++)
+      all[e] += sum.counts[p][e];
+  }
+  if (sum.units[generate])
+    row("all", "tx", sum.units[generate], all);
+  if (sum.units[query])
+    row("all", "query", sum.units[query], all);
+}
+
+} // namespace perf
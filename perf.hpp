@@ -0,0 +1,74 @@
+#pragma once
+#include <array>
+#include <iosfwd>
+#include <cstdint>
+
+// Hardware performance counters of the calling thread, read through
+// perf_event_open(2), user space only.
+//
+// The counters of a thread are opened on its first read, as one
+// group. The ones the kernel refuses (perf_event_paranoid,
+// containers and virtual machines without a PMU, other kernels)
+// are left out and read as 0; see available(). So is the group
+// until the PMU schedules it; counts of a group sharing the PMU
+// with others are scaled to the time it was enabled.
+namespace perf
+{
+enum Event
+{
+    cycles,
+    instructions,
+    llc_misses,
+    branch_misses,
+    dtlb_misses,
+    num_events
+};
+extern char const *const names[num_events];
+
+using Values = std::array<std::uint64_t, num_events>;
+
+Values read();
+// the counters opened and scheduled for the calling thread
+std::array<bool, num_events> available();
+
+// Phases of the protocol the counters are attributed to, once
+// enable() is called (--perf). units: transactions generated,
+// queries answered, node rounds (prepare, apply and prune).
+enum Phase
+{
+    generate,
+    prepare,
+    query,
+    apply,
+    prune,
+    num_phases
+};
+
+extern bool enabled;
+void enable();
+
+// adds the counts from its construction to its destruction to the
+// phase, for the calling thread.
+class Scope
+{
+public:
+    explicit Scope(Phase phase, std::uint64_t units = 1)
+        : phase(enabled ? int(phase) : -1), units(units)
+    {
+        if (enabled)
+            start = read();
+    }
+    ~Scope();
+    Scope(Scope const &) = delete;
+    Scope &operator=(Scope const &) = delete;
+
+private:
+    int phase;
+    std::uint64_t units;
+    Values start;
+};
+
+// per phase and unit, then per transaction and per query, summed
+// over every thread.
+void report(std::ostream &);
+} // namespace perf
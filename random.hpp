@@ -0,0 +1,85 @@
+#pragma once
+#include <limits>
+#include <random>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// Counter-based random number generator.
+//
+// The n-th value of the stream (seed, stream) is a pure function of
+// (seed, stream, n): every node draws from its own stream, so the
+// values it gets do not depend on how nodes are scheduled across
+// threads. Satisfies UniformRandomBitGenerator.
+class CounterRng
+{
+public:
+    using result_type = std::uint64_t;
+
+    CounterRng(std::uint64_t seed, std::uint64_t stream)
+        : key(mix(seed ^ mix(stream + golden))), counter(0) {}
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()() { return mix(key + golden * ++counter); }
+
+private:
+    friend class Snapshot;
+
+    static constexpr std::uint64_t golden = 0x9e3779b97f4a7c15ULL;
+
+    // splitmix64 finalizer
+    static std::uint64_t mix(std::uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    std::uint64_t key, counter;
+};
+
+// Draws k distinct peers among nodes 0 ... n-1 other than `self`,
+// with Floyd's algorithm. Membership of the draws is tested in a
+// small open-addressing table, so a draw costs O(k) and, once the
+// buffers have grown to k, allocates nothing. The result is only
+// valid until the next draw.
+class PeerSampler
+{
+public:
+    template <typename Rng>
+    std::vector<int> const &sample(int n, int self, int k, Rng &rng)
+    {
+        auto m = n - 1; // candidates, self excluded
+        k = std::max(0, std::min(k, m));
+        peers.clear();
+
+        std::size_t size = 4;
+        while (size < 2 * std::size_t(k))
+            size *= 2;
+        if (table.size() < size)
+            table.resize(size);
+        std::fill(table.begin(), table.begin() + size, -1);
+        auto mask = size - 1;
+
+        // inserts c, unless already drawn.
+        auto insert = [&](int c) {
+            auto h = (std::uint32_t(c) * 0x9e3779b1u) & mask;
+            for (; table[h] != -1; h = (h + 1) & mask)
+                if (table[h] == c)
+                    return false;
+            table[h] = c;
+            peers.push_back(c < self ? c : c + 1);
+            return true;
+        };
+
+        for (auto j = m - k; j < m; j++)
+            if (!insert(std::uniform_int_distribution<int>(0, j)(rng)))
+                insert(j);
+        return peers;
+    }
+
+private:
+    std::vector<int> peers, table;
+};
@@ -0,0 +1,281 @@
+#include "runner.hpp"
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <boost/format.hpp>
+
+#include "snapshot.hpp"
+
+using namespace std;
+
+RunResult runTicks(Network &net, ClientState &client, ostream *log) {
+  auto &p = net.params;
+  auto start = chrono::steady_clock::now();
+  auto &n1 = net.nodes[0];
+  uniform_real_distribution<double> next_double(0.0, 1.0);
+  auto &c1 = client.c1, &c2 = client.c2;
+  RunResult rc;
+
+  // client transactions not yet accepted by node 0, and the tick
+  // they were issued at.
+  vector<pair<TxPtr, uint64_t>> pending;
+  uint64_t total = 0;
+
+  // simulate a client
+  for (auto i = client.next; i < p.num_transactions; i++) {
+    // pic a random node.
+    std::uniform_int_distribution<int> dist(0, net.nodes.size() - 1);
+    auto &n = net.nodes[dist(net.rng)];
+
+    // send a transaction
+    auto &tx = *c1.insert(n->onGenerateTx(i)).first;
+    pending.push_back({tx, net.ticks});
+    rc.issued++;
+
+    if (next_double(net.rng) < p.double_spend_ratio) {
+      // generate a double spend
+      auto d = uniform_int_distribution<int>(0, i)(net.rng);
+      if (log)
+        *log << "double spend of " << d << endl;
+      auto nodes = net.nodes;
+      shuffle(nodes.begin(), nodes.end(), net.rng);
+      auto &n2 = nodes.front();
+      c2.insert(n2->onGenerateTx(d));
+    }
+
+    net.run();
+    if (net.checkMemory() && log)
+      *log << "memory budget reached: pruning turned on" << endl;
+
+    auto out = pending.begin();
+    for (auto &[t, issued] : pending)
+      if (n1->isAccepted(t)) {
+        auto ticks = int(net.ticks - issued);
+        total += ticks;
+        rc.max_ticks = max(rc.max_ticks, ticks);
+        rc.accepted++;
+      } else
+        *out++ = {t, issued};
+    pending.erase(out, pending.end());
+
+    if (p.dump_dags) {
+      ostringstream ss;
+      ss << boost::format("znode-0-%03d.dot") % i;
+      n1->dumpDag(ss.str());
+    }
+    if (log)
+      *log << i << ":  " << n1->fractionAccepted() << endl;
+    if (log && p.memory_every && (i + 1) % p.memory_every == 0)
+      reportMemory(*log, net, false);
+
+    if (p.checkpoint_every && (i + 1) % p.checkpoint_every == 0) {
+      client.next = i + 1;
+      Snapshot::save(p.checkpoint, net, client);
+    }
+  }
+  client.next = max(client.next, p.num_transactions);
+
+  rc.mean_ticks = rc.accepted ? double(total) / rc.accepted : 0;
+  forEachDoubleSpend(net, client, [&](int, auto &, auto &, bool a1, bool a2) {
+    (a1 && a2 ? rc.both : a1 || a2 ? rc.one : rc.none)++;
+  });
+  rc.fraction_accepted = n1->fractionAccepted();
+  rc.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  return rc;
+}
+
+void sweep(Parameters const &params, ostream &out) {
+  // the grid, first axis varying slowest.
+  vector<Parameters> configs(1, params);
+  for (auto &[name, values] : params.sweep) {
+    vector<Parameters> next;
+    for (auto &c : configs)
+      for (auto v : values) {
+        auto p = c;
+        if (name == "alpha")
+          p.alpha = v;
+        else if (name == "k")
+          p.k = int(v);
+        else if (name == "beta1")
+          p.beta1 = int(v);
+        else if (name == "beta2")
+          p.beta2 = int(v);
+        else
+          p.double_spend_ratio = v;
+        next.push_back(p);
+      }
+    configs.swap(next);
+  }
+  for (auto &c : configs) {
+    c.threads = 1;
+    c.dump_dags = false;
+    c.checkpoint_every = 0;
+  }
+
+  vector<RunResult> results(configs.size());
+  ThreadPool pool(params.threads);
+  pool.parallel_for(configs.size(), [&](size_t i) {
+    Network net(configs[i]);
+    ClientState client;
+    try {
+      results[i] = runTicks(net, client, nullptr);
+    } catch (const runtime_error &e) {
+      results[i].error = e.what();
+    }
+  });
+
+  out << boost::format("%6s %4s %5s %5s %8s | %9s %10s %9s | %5s %5s %5s | %8s\n") %
+             "alpha" % "k" % "beta1" % "beta2" % "ds_ratio" % "accepted" % "mean_ticks" %
+             "max_ticks" % "both" % "one" % "none" % "wall_s";
+  for (size_t i = 0; i < configs.size(); i++) {
+    auto &c = configs[i];
+    auto &r = results[i];
+    if (!r.error.empty())
+      out << boost::format("%6.3f %4d %5d %5d %8.4f | %s\n") % c.alpha % c.k % c.beta1 % c.beta2 %
+                 c.double_spend_ratio % r.error;
+    else
+      out << boost::format("%6.3f %4d %5d %5d %8.4f | %9.4f %10.2f %9d | %5d %5d %5d | %8.3f\n") %
+                 c.alpha % c.k % c.beta1 % c.beta2 % c.double_spend_ratio %
+                 (r.issued ? double(r.accepted) / r.issued : 0) % r.mean_ticks % r.max_ticks %
+                 r.both % r.one % r.none % r.seconds;
+  }
+}
+
+pair<double, double> wilson(double x, double n, double z) {
+  if (n <= 0)
+    return {0, 1};
+  auto z2 = z * z;
+  auto center = (x + z2 / 2) / (n + z2);
+  auto half = z / (n + z2) * sqrt(double(x) * (n - x) / n + z2 / 4);
+  return {max(0.0, center - half), min(1.0, center + half)};
+}
+
+// sums over the runs of an ensemble of the pairs n_i of a run
+// and of the pairs x_i with one outcome, for the intervals
+// clustered by run (see ensemble).
+struct Clustered {
+  double x = 0, xx = 0, xn = 0;
+
+  void add(int xi, int ni) {
+    x += xi;
+    xx += double(xi) * xi;
+    xn += double(xi) * ni;
+  }
+};
+
+void ensemble(Parameters const &params, ostream &out) {
+  // rounds of a fixed number of runs, so that where the ensemble
+  // stops does not depend on the number of threads.
+  const int round = 64;
+  ThreadPool pool(params.threads);
+  uint64_t runs = 0, violations = 0, failed = 0, clusters = 0;
+  Clustered both, one, none;
+  double pairs = 0, pairs2 = 0; // Σ n_i, Σ n_i²
+  auto start = chrono::steady_clock::now();
+  bool precise = false;
+
+  while (runs < uint64_t(params.ensemble) && !precise) {
+    auto n = min<uint64_t>(round, params.ensemble - runs);
+    vector<RunResult> results(n);
+    pool.parallel_for(n, [&](size_t i) {
+      auto p = params;
+      p.seed = params.seed + runs + i;
+      p.threads = 1;
+      p.dump_dags = false;
+      p.checkpoint_every = 0;
+      Network net(p);
+      ClientState client;
+      try {
+        results[i] = runTicks(net, client, nullptr);
+      } catch (const runtime_error &e) {
+        results[i].error = e.what();
+      }
+    });
+    // a run stopped by the memory budget has no outcome: it is
+    // left out, rather than counted as one without double spend.
+    for (auto &r : results) {
+      if (!r.error.empty()) {
+        failed++;
+        continue;
+      }
+      auto ni = r.both + r.one + r.none;
+      both.add(r.both, ni);
+      one.add(r.one, ni);
+      none.add(r.none, ni);
+      pairs += ni;
+      pairs2 += double(ni) * ni;
+      clusters += ni > 0;
+      violations += r.both > 0;
+    }
+    runs += n;
+    // the runs are independent trials, the pairs of a run are not.
+    auto [lo, hi] = wilson(violations, runs - failed);
+    precise = params.precision > 0 && runs > failed && hi - lo <= 2 * params.precision;
+  }
+
+  out << "runs: " << runs << ", double spends: " << uint64_t(pairs) << ", wall: "
+      << chrono::duration<double>(chrono::steady_clock::now() - start).count() << "s"
+      << (precise ? " (precision reached)" : "") << endl;
+  if (failed)
+    out << failed << " runs stopped early (memory budget), left out" << endl;
+  out << boost::format("%-10s %10s %12s   %s\n") % "outcome" % "count" % "p" % "95% interval";
+  auto row = [&](char const *name, double x, double n) {
+    auto [lo, hi] = wilson(x, n);
+    out << boost::format("%-10s %10d %12.4e   [%.4e, %.4e]\n") % name % uint64_t(x) %
+               (n ? x / n : 0.0) % lo % hi;
+  };
+  // the pairs of a run share its network, so the Wilson interval
+  // of an outcome is taken over the effective number of pairs
+  // n / deff, deff being the ratio of the variance of x / n
+  // clustered by run to the binomial one, at least 1. With no
+  // spread to estimate it from (x = 0 or n), the runs with pairs
+  // are the trials.
+  auto clustered = [&](char const *name, Clustered const &c) {
+    auto p = pairs ? c.x / pairs : 0;
+    auto m = double(clusters);
+    auto eff = m;
+    if (c.x > 0 && c.x < pairs && m > 1) {
+      auto v = m / (m - 1) * (c.xx - 2 * p * c.xn + p * p * pairs2) / (pairs * pairs);
+      auto deff = max(1.0, v / (p * (1 - p) / pairs));
+      eff = pairs / deff;
+    }
+    auto [lo, hi] = wilson(p * eff, eff);
+    out << boost::format("%-10s %10d %12.4e   [%.4e, %.4e]\n") % name % uint64_t(c.x) % p % lo % hi;
+  };
+  clustered("both", both);
+  clustered("one", one);
+  clustered("none", none);
+  // completed runs with some double spend accepted twice
+  row("violated", violations, runs - failed);
+}
+
+void reportMemory(ostream &out, Network const &net, bool detailed) {
+  NodeMemory sum, largest;
+  for (auto &n : net.nodes) {
+    auto m = n->memory();
+    sum += m;
+    if (m.total() > largest.total())
+      largest = m;
+  }
+  auto mb = [](size_t bytes) { return bytes / 1048576.0; };
+  auto table = net.table.bytes();
+  out << boost::format("memory: %.1f MB (table %.1f MB, nodes %.1f MB, largest node %.2f MB)") %
+             mb(table + sum.total()) % mb(table) % mb(sum.total()) % mb(largest.total());
+  if (net.params.prune)
+    out << ", pruned below " << net.watermark;
+  out << endl;
+  if (!detailed)
+    return;
+  out << boost::format("%-18s %12s %16s\n") % "nodes, MB" % "all" % "largest node";
+  auto row = [&](char const *name, size_t all, size_t one) {
+    out << boost::format("%-18s %12.2f %16.3f\n") % name % mb(all) % mb(one);
+  };
+  row("transactions", sum.transactions, largest.transactions);
+  row("conflicts", sum.conflicts, largest.conflicts);
+  row("children", sum.children, largest.children);
+  row("vote state", sum.vote_state, largest.vote_state);
+  row("preference", sum.preference, largest.preference);
+  row("parent selection", sum.parent_selection, largest.parent_selection);
+  row("queues", sum.queues, largest.queues);
+}
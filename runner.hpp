@@ -0,0 +1,82 @@
+#pragma once
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <cstdint>
+#include <vector>
+
+#include "avalanche.hpp"
+
+// state of the client of the lock-step simulation.
+struct ClientState
+{
+    int next = 0; // next transaction to issue
+    TxSet c1, c2; // transactions issued, and double spends
+};
+
+// outcome of a run of the tick engine.
+struct RunResult
+{
+    int issued = 0;       // client transactions issued by the run
+    int accepted = 0;     // of them, accepted by node 0
+    double mean_ticks = 0; // from issue to acceptance by node 0
+    int max_ticks = 0;
+    // double spends, by number of sides accepted by some node
+    int both = 0, one = 0, none = 0;
+    double fraction_accepted = 0; // of node 0
+    double seconds = 0;           // wall time
+    std::string error;            // why the run stopped, if it did
+};
+
+// runs the client of the tick engine on `net`, from client.next up
+// to params.num_transactions, saving snapshots as asked by the
+// parameters. The progress is printed to `log`, if any.
+RunResult runTicks(Network &net, ClientState &client, std::ostream *log);
+
+// estimated memory of the network (see Network::memory): one
+// line, with the network watermark when pruning, or the bytes of
+// every group of containers, over all the nodes and for the
+// largest one.
+void reportMemory(std::ostream &out, Network const &net, bool detailed);
+
+// calls f(data, tx1, tx2, accepted1, accepted2) on every pair of
+// conflicting client transactions, a side being accepted if some
+// node accepted it.
+template <typename F>
+void forEachDoubleSpend(Network const &net, ClientState const &client, F f)
+{
+    std::map<int, std::vector<TxPtr>> conflict_sets;
+    for (auto &t : client.c1)
+        conflict_sets[t->data].push_back(t);
+    for (auto &t : client.c2)
+        conflict_sets[t->data].push_back(t);
+    auto anyNode = [&](TxPtr const &tx) {
+        for (auto &n : net.nodes)
+            if (n->isAccepted(tx))
+                return true;
+        return false;
+    };
+    for (auto &[v, l] : conflict_sets)
+        if (l.size() == 2)
+            f(v, l[0], l[1], anyNode(l[0]), anyNode(l[1]));
+}
+
+// runs every configuration of the grid params.sweep concurrently,
+// on params.threads threads, and prints one row per configuration
+// to `out`. The configurations share the seed, so that they see the
+// same client and node random streams as long as they draw the same.
+void sweep(Parameters const &params, std::ostream &out);
+
+// Wilson score interval of a binomial proportion, x successes out
+// of n trials, at `z` standard deviations. n may be an effective
+// number of trials, not an integer.
+std::pair<double, double> wilson(double x, double n, double z = 1.96);
+
+// runs params.ensemble independent runs of the tick engine, with
+// the seeds params.seed, params.seed + 1, ..., on params.threads
+// threads, each holding one network at a time, and prints the
+// outcomes of the double spends with their 95% intervals,
+// clustered by run. Stops early once the interval of the share of
+// runs with a double spend accepted on both sides is narrower than
+// 2 * params.precision.
+void ensemble(Parameters const &params, std::ostream &out);
@@ -0,0 +1,218 @@
+#include "simulation.hpp"
+#include "perf.hpp"
+#include "runner.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <boost/format.hpp>
+
+using namespace std;
+
+EventSimulation::EventSimulation(Network &net, TxSet &c1, TxSet &c2)
+    : net(net), params(net.params), c1(c1), c2(c2),
+      rng(params.seed ^ 0x5eedULL), polling(net.nodes.size(), false),
+      timeouts(net.nodes.size(), false) {}
+
+void EventSimulation::run() {
+  if (params.num_transactions > 0)
+    push(0, {Event::Client, 0, 0, 0});
+
+  while (!events.empty()) {
+    auto e = events.pop().event;
+    num_events++;
+    switch (e.kind) {
+    case Event::Client:
+      onClient(int(e.value));
+      break;
+    case Event::Submit:
+      onSubmit(e.node, int(e.value), e.id);
+      break;
+    case Event::Poll:
+      if (e.id)
+        timeouts[e.node] = false;
+      onPoll(e.node);
+      break;
+    case Event::Query:
+      if (missingAncestors(e.node, queries[e.id].txs)) {
+        // the peer lacks ancestors of the queried vertex: it
+        // fetches them from the sender before answering.
+        num_fetches++;
+        push(params.latency(rng) + params.latency(rng), {Event::Fetched, e.node, e.id, 0});
+        break;
+      }
+      onQuery(e.node, e.id);
+      break;
+    case Event::Fetched:
+      onQuery(e.node, e.id);
+      break;
+    case Event::Response:
+      onResponse(e.id, e.value);
+      break;
+    }
+  }
+}
+
+// same client as the lock-step simulation in main.cpp: a transaction
+// on a random node, and from time to time a double spend of an
+// earlier one on another random node.
+void EventSimulation::onClient(int i) {
+  uniform_real_distribution<double> next_double(0.0, 1.0);
+  uniform_int_distribution<int> pick(0, net.nodes.size() - 1);
+
+  push(params.client_latency(rng), {Event::Submit, pick(net.rng), 0, uint64_t(i)});
+  if (next_double(net.rng) < params.double_spend_ratio) {
+    auto d = uniform_int_distribution<int>(0, i)(net.rng);
+    cout << "double spend of " << d << endl;
+    push(params.client_latency(rng), {Event::Submit, pick(net.rng), 1, uint64_t(d)});
+  }
+
+  auto &n1 = net.nodes[0];
+  if (params.dump_dags) {
+    ostringstream ss;
+    ss << boost::format("znode-0-%03d.dot") % i;
+    n1->dumpDag(ss.str());
+  }
+  cout << i << ":  " << n1->fractionAccepted()
+       << boost::format("  @%.1fms") % (events.now() / 1e3) << endl;
+
+  net.prune();
+  if (net.checkMemory())
+    cout << "memory budget reached: pruning turned on" << endl;
+  if (params.memory_every && (i + 1) % params.memory_every == 0)
+    reportMemory(cout, net, false);
+  if (i + 1 < params.num_transactions)
+    push(params.tx_interval(rng), {Event::Client, 0, 0, uint64_t(i + 1)});
+}
+
+void EventSimulation::onSubmit(int node, int data, bool double_spend) {
+  auto t = net.nodes[node]->onGenerateTx(data);
+  (double_spend ? c2 : c1).insert(t);
+  if (t->idx >= issued.size()) {
+    issued.resize(t->idx + 1);
+    accepted_by.resize(t->idx + 1);
+  }
+  issued[t->idx] = events.now();
+  schedulePoll(node);
+}
+
+void EventSimulation::schedulePoll(int node) {
+  if (!polling[node]) {
+    polling[node] = true;
+    push(0, {Event::Poll, node, 0, 0});
+  }
+}
+
+// true if `node` knows neither a transaction of the vertex nor
+// one of its parents that is not part of the vertex.
+bool EventSimulation::missingAncestors(int node, vector<TxPtr> const &txs) const {
+  auto &v = *net.nodes[node];
+  auto in_vertex = [&](TxIndex p) {
+    return any_of(txs.begin(), txs.end(), [p](auto &t) { return t->idx == p; });
+  };
+  return any_of(txs.begin(), txs.end(), [&](auto &t) {
+    return !v.knows(t->idx) &&
+           any_of(t->parents.begin(), t->parents.end(),
+                  [&](auto p) { return !v.knows(p) && !in_vertex(p); });
+  });
+}
+
+void EventSimulation::onPoll(int node) {
+  polling[node] = false;
+  auto &u = *net.nodes[node];
+  u.prepareQueries(events.now() / 1000);
+  if (u.batchPending() && !timeouts[node]) {
+    // wake up when the incomplete vertex is due.
+    timeouts[node] = true;
+    events.push(u.batchDeadline() * 1000, {Event::Poll, node, 1, 0});
+  }
+
+  auto &out = u.outbox;
+  for (size_t i = 0; i < out.size(); i++) {
+    uint32_t id;
+    if (free_queries.empty()) {
+      id = queries.size();
+      queries.push_back({});
+    } else {
+      id = free_queries.back();
+      free_queries.pop_back();
+    }
+    auto &q = queries[id];
+    q.sender = node;
+    q.txs.assign(out.vertex(i), out.vertex(i) + out.count(i));
+    q.votes.assign(q.txs.size(), 0);
+    q.remaining = int(out.width);
+    num_queries++;
+
+    for (size_t j = 0; j < out.width; j++)
+      push(params.latency(rng), {Event::Query, out.peers[i * out.width + j], id, 0});
+    if (out.width == 0)
+      onResponse(id, 0);
+  }
+  out.txs.clear();
+}
+
+void EventSimulation::onQuery(int node, uint32_t id) {
+  ZKS_SPAN("onQuery", node);
+  perf::Scope scope(perf::query);
+  auto &q = queries[id];
+  auto &v = *net.nodes[node];
+  auto fresh = any_of(q.txs.begin(), q.txs.end(), [&](auto &t) { return !v.knows(t->idx); });
+  auto r = v.onQuery(*net.nodes[q.sender], q.txs.data(), q.txs.size());
+  if (fresh)
+    schedulePoll(node);
+  push(params.latency(rng), {Event::Response, q.sender, id, r});
+}
+
+void EventSimulation::onResponse(uint32_t id, uint64_t value) {
+  auto &q = queries[id];
+  for (size_t i = 0; i < q.votes.size(); i++)
+    q.votes[i] += (value >> i) & 1;
+  if (--q.remaining > 0)
+    return;
+
+  auto &u = *net.nodes[q.sender];
+  {
+    perf::Scope scope(perf::apply);
+    for (size_t i = 0; i < q.txs.size(); i++) {
+      u.applyVote(q.txs[i], q.votes[i]);
+      for (auto idx : u.newlyAccepted()) {
+        if (idx >= issued.size())
+          continue; // not issued by the client
+        auto latency = (events.now() - issued[idx]) / 1e3;
+        node_latencies.push_back(latency);
+        if (++accepted_by[idx] == int(net.nodes.size()))
+          network_latencies.push_back(latency);
+      }
+    }
+  }
+  q.txs.clear();
+  free_queries.push_back(id);
+  u.prune();
+}
+
+namespace {
+void summary(ostream &out, const char *what, vector<double> v, size_t total) {
+  out << "latency to acceptance " << what << " (ms): ";
+  if (v.empty()) {
+    out << "none accepted (0 of " << total << ")" << endl;
+    return;
+  }
+  sort(v.begin(), v.end());
+  auto pct = [&v](double p) { return v[size_t(p * (v.size() - 1))]; };
+  double sum = 0;
+  for (auto x : v)
+    sum += x;
+  out << boost::format("mean=%.1f p50=%.1f p90=%.1f p99=%.1f max=%.1f") %
+             (sum / v.size()) % pct(0.5) % pct(0.9) % pct(0.99) % v.back()
+      << " (" << v.size() << " of " << total << ")" << endl;
+}
+} // namespace
+
+void EventSimulation::report(ostream &out) const {
+  out << boost::format("simulated time: %.1fms, events: %d, queries: %d, "
+                       "ancestor fetches: %d") %
+             (events.now() / 1e3) % num_events % num_queries % num_fetches
+      << endl;
+  size_t issued_txs = c1.size() + c2.size();
+  summary(out, "per node", node_latencies, issued_txs * net.nodes.size());
+  summary(out, "by all nodes", network_latencies, issued_txs);
+}
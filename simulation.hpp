@@ -0,0 +1,85 @@
+#pragma once
+#include <random>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+#include "latency.hpp"
+#include "avalanche.hpp"
+#include "timing_wheel.hpp"
+
+// Discrete-event simulation of a Network.
+//
+// Instead of the lock-step ticks of Network::run, every interaction
+// is a timed event: the client submits transactions to nodes after
+// params.client_latency, at intervals drawn from params.tx_interval;
+// queries, their answers and ancestor fetches are messages delayed
+// by params.latency. A node only works when one of its messages
+// arrives, and acceptance latencies are measured in simulated time.
+class EventSimulation
+{
+public:
+    // transactions issued by the client go to `c1`, double spends
+    // to `c2` (see main.cpp).
+    EventSimulation(Network &net, TxSet &c1, TxSet &c2);
+
+    // runs the client for params.num_transactions, then until
+    // every query has been answered.
+    void run();
+    void report(std::ostream &) const;
+
+private:
+    struct Event
+    {
+        enum Kind : std::uint8_t
+        {
+            Client,   // client issues transaction `value`
+            Submit,   // `node` generates a transaction for data `value`
+                      // (a double spend if `id` is 1)
+            Poll,     // `node` queries the transactions it has not queried
+                      // (`id` is 1 for a vertex timeout)
+            Query,    // query `id` reaches `node`
+            Fetched,  // ancestors of query `id` reached `node`
+            Response, // answer `value` to query `id` reaches its sender,
+                      // one bit per transaction of the vertex
+        } kind;
+        int node;
+        std::uint32_t id;
+        std::uint64_t value;
+    };
+
+    // a vertex in flight; the vectors are recycled with the slot.
+    struct PendingQuery
+    {
+        int sender;
+        std::vector<TxPtr> txs;
+        std::vector<int> votes;
+        int remaining;
+    };
+
+    void onClient(int i);
+    void onSubmit(int node, int data, bool double_spend);
+    void onPoll(int node);
+    void onQuery(int node, std::uint32_t id);
+    void onResponse(std::uint32_t id, std::uint64_t value);
+    void schedulePoll(int node);
+    bool missingAncestors(int node, std::vector<TxPtr> const &txs) const;
+    void push(SimTime delay, Event e) { events.push(events.now() + delay, e); }
+
+    Network &net;
+    Parameters const &params;
+    TxSet &c1, &c2;
+    TimingWheel<Event> events;
+    std::mt19937_64 rng; // latencies
+
+    std::vector<PendingQuery> queries;
+    std::vector<std::uint32_t> free_queries;
+    std::vector<bool> polling, timeouts;
+
+    // acceptance latencies, in ms
+    std::vector<SimTime> issued;   // by TxIndex
+    std::vector<int> accepted_by;  // by TxIndex
+    std::vector<double> node_latencies, network_latencies;
+
+    std::uint64_t num_events = 0, num_queries = 0, num_fetches = 0;
+};
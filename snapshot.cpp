@@ -0,0 +1,422 @@
+#include "snapshot.hpp"
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace {
+const char magic[8] = {'Z', 'K', 'S', 'S', 'N', 'A', 'P', 0};
+const uint32_t version = 4;
+const TxIndex none = ~TxIndex(0);
+} // namespace
+
+class Snapshot::Writer {
+public:
+  template <typename T> void put(T const &v) {
+    static_assert(is_trivially_copyable<T>::value, "not a plain value");
+    buf.append(reinterpret_cast<char const *>(&v), sizeof v);
+  }
+  template <typename T> void put(vector<T> const &v) {
+    put(uint64_t(v.size()));
+    buf.append(reinterpret_cast<char const *>(v.data()), v.size() * sizeof(T));
+  }
+  void put(string const &s) {
+    put(uint64_t(s.size()));
+    buf.append(s);
+  }
+  void put(TxBitset const &b) { put(b.words); }
+  void put(TxBitmap const &b) {
+    put(b.words);
+    put(uint64_t(b.offset));
+    put(b.fill);
+    put(b.kept);
+    put(b.kept_set);
+  }
+  template <typename T> void put(TxArray<T> const &a) {
+    put(a.first);
+    put(a.values);
+    put(a.kept);
+  }
+  void put(CounterRng const &r) {
+    put(r.key);
+    put(r.counter);
+  }
+  void put(TxPtr const &tx) { put(tx ? tx->idx : none); }
+  void put(Tx const &tx) {
+    put(tx.idx);
+    put(tx.id);
+    put(tx.data);
+    put(tx.parents);
+    put(tx.ancestors);
+  }
+
+  string buf;
+};
+
+class Snapshot::Reader {
+public:
+  Reader(char const *p, size_t n) : p(p), end(p + n) {}
+
+  template <typename T> T get() {
+    static_assert(is_trivially_copyable<T>::value, "not a plain value");
+    T v;
+    memcpy(&v, take(sizeof v), sizeof v);
+    return v;
+  }
+  template <typename T> void get(vector<T> &v) {
+    auto n = get<uint64_t>();
+    if (n > size_t(end - p) / sizeof(T))
+      throw runtime_error("truncated snapshot");
+    v.resize(n);
+    memcpy(v.data(), take(n * sizeof(T)), n * sizeof(T));
+  }
+  void get(string &s) {
+    auto n = get<uint64_t>();
+    s.assign(take(n), n);
+  }
+  void get(TxBitset &b) { get(b.words); }
+  void get(TxBitmap &b) {
+    get(b.words);
+    b.offset = get<uint64_t>();
+    b.fill = get<bool>();
+    get(b.kept);
+    get(b.kept_set);
+  }
+  template <typename T> void get(TxArray<T> &a) {
+    a.first = get<TxIndex>();
+    get(a.values);
+    get(a.kept);
+  }
+  void get(CounterRng &r) {
+    r.key = get<uint64_t>();
+    r.counter = get<uint64_t>();
+  }
+  void skip(size_t n) { take(n); }
+  TxPtr tx(vector<TxPtr> const &bodies) {
+    auto idx = get<TxIndex>();
+    if (idx == none)
+      return nullptr;
+    if (idx >= bodies.size() || !bodies[idx])
+      throw runtime_error("snapshot refers to a missing transaction");
+    return bodies[idx];
+  }
+  TxPtr body() {
+    auto idx = get<TxIndex>();
+    auto id = get<UUID>();
+    auto data = get<int>();
+    TxIndexes parents;
+    get(parents);
+    TxBitset ancestors;
+    get(ancestors);
+    return make_shared<const Tx>(idx, id, data, std::move(parents), std::move(ancestors));
+  }
+
+private:
+  char const *take(size_t n) {
+    if (n > size_t(end - p))
+      throw runtime_error("truncated snapshot");
+    auto q = p;
+    p += n;
+    return q;
+  }
+
+  char const *p, *end;
+};
+
+Snapshot::Snapshot(string const &path) {
+  auto fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw runtime_error("cannot open snapshot " + path);
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    auto p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      data = static_cast<char const *>(p);
+      size = st.st_size;
+    }
+  }
+  close(fd);
+  if (!data)
+    throw runtime_error("cannot map snapshot " + path);
+
+  Reader in(data, size);
+  char m[sizeof magic];
+  for (auto &c : m)
+    c = in.get<char>();
+  if (memcmp(m, magic, sizeof magic) != 0 || in.get<uint32_t>() != version) {
+    munmap(const_cast<char *>(data), size);
+    throw runtime_error(path + " is not a snapshot of this version");
+  }
+}
+
+Snapshot::~Snapshot() { munmap(const_cast<char *>(data), size); }
+
+void Snapshot::write(Writer &out, Parameters const &p) {
+  out.put(p.seed);
+  out.put(p.num_nodes);
+  out.put(p.k);
+  out.put(p.alpha);
+  out.put(p.beta1);
+  out.put(p.beta2);
+  out.put(p.max_parents);
+  out.put(p.batch_size);
+  out.put(p.batch_timeout);
+  out.put(p.double_spend_ratio);
+  out.put(p.prune);
+}
+
+void Snapshot::read(Reader &in, Parameters &p) {
+  p.seed = in.get<decltype(p.seed)>();
+  p.num_nodes = in.get<int>();
+  p.k = in.get<int>();
+  p.alpha = in.get<double>();
+  p.beta1 = in.get<int>();
+  p.beta2 = in.get<int>();
+  p.max_parents = in.get<int>();
+  p.batch_size = in.get<int>();
+  p.batch_timeout = in.get<int>();
+  p.double_spend_ratio = in.get<double>();
+  p.prune = in.get<bool>();
+}
+
+Parameters Snapshot::parameters(Parameters const &p) const {
+  Reader in(data, size);
+  in.skip(sizeof magic + sizeof version);
+  auto rc = p;
+  read(in, rc);
+  return rc;
+}
+
+void Snapshot::write(Writer &out, Node const &n) {
+  out.put(n.node_id);
+  out.put(n.rng);
+
+  TxIndexes txs;
+  for (auto &[idx, tx] : n.transactions)
+    txs.push_back(idx);
+  out.put(txs);
+
+  out.put(uint64_t(n.conflicts.size()));
+  for (auto &[data, cs] : n.conflicts) {
+    out.put(data);
+    out.put(cs.pref);
+    out.put(cs.last);
+    out.put(cs.count);
+    out.put(cs.size);
+    out.put(cs.pruned);
+  }
+
+  // sorted, so that equal states give equal snapshots.
+  vector<TxIndex> keys;
+  for (auto &kv : n.children)
+    keys.push_back(kv.first);
+  sort(keys.begin(), keys.end());
+  out.put(keys);
+  for (auto k : keys)
+    out.put(n.children.at(k));
+
+  out.put(n.unqueried);
+  out.put(n.batch_since);
+  out.put(n.batching);
+  out.put(n.watermark);
+  out.put(n.skipped);
+  out.put(n.residual);
+  out.put(n.spent);
+
+  for (auto b : {&n.known, &n.queried, &n.accepted, &n.chits, &n.inflight})
+    out.put(*b);
+  out.put(n.confidence);
+  out.put(uint64_t(n.num_accepted));
+  out.put(n.unprefered);
+  out.put(n.unprefered_ancestors);
+  out.put(n.eligible);
+  out.put(n.eligible_children);
+  out.put(TxIndexes(n.tips.begin(), n.tips.end()));
+  out.put(TxIndexes(n.recent.begin(), n.recent.end()));
+}
+
+void Snapshot::read(Reader &in, Node &n, vector<TxPtr> const &bodies) {
+  if (in.get<int>() != n.node_id)
+    throw runtime_error("snapshot nodes out of order");
+  in.get(n.rng);
+
+  TxIndexes txs;
+  in.get(txs);
+  n.transactions.clear();
+  for (auto idx : txs)
+    if (idx >= bodies.size() || !bodies[idx])
+      throw runtime_error("snapshot refers to a missing transaction");
+    else
+      n.transactions.insert({idx, bodies[idx]});
+
+  n.conflicts.clear();
+  for (auto i = in.get<uint64_t>(); i > 0; i--) {
+    auto data = in.get<int>();
+    auto pref = in.tx(bodies);
+    auto last = in.tx(bodies);
+    auto count = in.get<int>();
+    auto size = in.get<int>();
+    ConflictSet cs{pref, last, count, size};
+    cs.pruned = in.get<int>();
+    n.conflicts.insert({data, std::move(cs)});
+  }
+
+  TxIndexes keys;
+  in.get(keys);
+  n.children.clear();
+  n.child_edges = 0;
+  for (auto k : keys) {
+    in.get(n.children[k]);
+    n.child_edges += n.children[k].size();
+  }
+
+  in.get(n.unqueried);
+  n.batch_since = in.get<uint64_t>();
+  n.batching = in.get<bool>();
+  n.watermark = in.get<TxIndex>();
+  n.skipped = in.get<TxIndex>();
+  in.get(n.residual);
+  in.get(n.spent);
+
+  for (auto b : {&n.known, &n.queried, &n.accepted, &n.chits, &n.inflight})
+    in.get(*b);
+  in.get(n.confidence);
+  n.num_accepted = in.get<uint64_t>();
+  in.get(n.unprefered);
+  in.get(n.unprefered_ancestors);
+  in.get(n.eligible);
+  in.get(n.eligible_children);
+  TxIndexes v;
+  in.get(v);
+  n.tips = {v.begin(), v.end()};
+  in.get(v);
+  n.recent = {v.begin(), v.end()};
+  n.wake.clear();
+  n.accepted_log.clear();
+}
+
+void Snapshot::save(string const &path, Network const &net, ClientState const &client) {
+  Writer out;
+  out.buf.append(magic, sizeof magic);
+  out.put(version);
+  write(out, net.params);
+
+  out.put(net.ticks);
+  out.put(net.watermark);
+  ostringstream rng;
+  rng << net.rng;
+  out.put(rng.str());
+  out.put(net.uuids.rng);
+
+  // bodies: the ones in the table, and the released ones that
+  // are still referenced (conflict sets, genesis, client).
+  auto &table = net.table;
+  vector<TxPtr> extra;
+  auto keep = [&](TxPtr const &tx) {
+    if (tx && !table.txs[tx->idx])
+      extra.push_back(tx);
+  };
+  keep(net.genesis);
+  for (auto &n : net.nodes)
+    for (auto &[data, cs] : n->conflicts)
+      keep(cs.pref), keep(cs.last);
+  for (auto s : {&client.c1, &client.c2})
+    for (auto &tx : *s)
+      keep(tx);
+  sort(extra.begin(), extra.end(), [](auto &a, auto &b) { return a->idx < b->idx; });
+  extra.erase(unique(extra.begin(), extra.end()), extra.end());
+
+  out.put(uint64_t(table.txs.size()));
+  out.put(uint64_t(count_if(table.txs.begin(), table.txs.end(), [](auto &tx) { return bool(tx); })));
+  for (auto &tx : table.txs)
+    if (tx)
+      out.put(*tx);
+  out.put(uint64_t(extra.size()));
+  for (auto &tx : extra)
+    out.put(*tx);
+  out.put(table.watermark);
+  out.put(table.kept);
+  out.put(net.genesis);
+
+  out.put(client.next);
+  for (auto s : {&client.c1, &client.c2}) {
+    TxIndexes v;
+    for (auto &tx : *s)
+      v.push_back(tx->idx);
+    out.put(v);
+  }
+
+  out.put(uint64_t(net.nodes.size()));
+  for (auto &n : net.nodes)
+    write(out, *n);
+
+  auto tmp = path + ".tmp";
+  {
+    ofstream fs(tmp, ios::binary | ios::trunc);
+    fs.write(out.buf.data(), out.buf.size());
+    if (!fs.flush())
+      throw runtime_error("cannot write snapshot " + tmp);
+  }
+  if (rename(tmp.c_str(), path.c_str()) != 0)
+    throw runtime_error("cannot rename snapshot to " + path);
+}
+
+void Snapshot::restore(Network &net, ClientState &client) const {
+  Reader in(data, size);
+  in.skip(sizeof magic + sizeof version);
+  Parameters p;
+  read(in, p);
+
+  net.ticks = in.get<uint64_t>();
+  net.watermark = in.get<TxIndex>();
+  string s;
+  in.get(s);
+  istringstream rng(s);
+  rng >> net.rng;
+  in.get(net.uuids.rng);
+
+  auto &table = net.table;
+  vector<TxPtr> bodies(in.get<uint64_t>());
+  table.txs.assign(bodies.size(), nullptr);
+  table.body_bytes = 0;
+  for (auto i = in.get<uint64_t>(); i > 0; i--) {
+    auto tx = in.body();
+    if (tx->idx >= bodies.size())
+      throw runtime_error("snapshot refers to a missing transaction");
+    bodies[tx->idx] = table.txs[tx->idx] = tx;
+    table.body_bytes += TxTable::footprint(*tx);
+  }
+  for (auto i = in.get<uint64_t>(); i > 0; i--) {
+    auto tx = in.body();
+    if (tx->idx >= bodies.size())
+      throw runtime_error("snapshot refers to a missing transaction");
+    bodies[tx->idx] = tx;
+  }
+  table.watermark = in.get<TxIndex>();
+  in.get(table.kept);
+  net.genesis = in.tx(bodies);
+
+  client.next = in.get<int>();
+  for (auto s : {&client.c1, &client.c2}) {
+    TxIndexes v;
+    in.get(v);
+    s->clear();
+    for (auto idx : v)
+      s->insert(bodies.at(idx));
+  }
+
+  if (in.get<uint64_t>() != net.nodes.size())
+    throw runtime_error("snapshot has a different number of nodes");
+  for (auto &n : net.nodes) {
+    read(in, *n, bodies);
+    n->genesis = net.genesis;
+  }
+}
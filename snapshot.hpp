@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+#include "avalanche.hpp"
+#include "runner.hpp"
+
+// Binary snapshot of a Network run by the tick engine and of its
+// client: transaction bodies, every node's state (transactions,
+// conflict sets, vote state, parent selection sets, random
+// stream) and the network's random generators, so that a resumed
+// run is identical to an uninterrupted one.
+//
+// The file is a header followed by fixed-width fields and
+// length-prefixed arrays in native byte order. It is written to a
+// temporary file first, then renamed, so that a crash leaves the
+// previous snapshot intact; it is read back through a read-only
+// memory mapping, the arrays being copied straight out of it.
+class Snapshot
+{
+public:
+    // maps the snapshot at `path`; throws std::runtime_error if it
+    // cannot be read or is not a snapshot.
+    explicit Snapshot(std::string const &path);
+    ~Snapshot();
+    Snapshot(Snapshot const &) = delete;
+    Snapshot &operator=(Snapshot const &) = delete;
+
+    // the parameters the snapshot was taken with; the ones that do
+    // not change the state of the network (number of transactions,
+    // threads, checkpoints, dumps) are taken from `p`, which
+    // parse_options keeps from setting the others.
+    Parameters parameters(Parameters const &p) const;
+
+    // overwrites `net`, built with parameters(), and `client`.
+    void restore(Network &net, ClientState &client) const;
+
+    static void save(std::string const &path, Network const &net, ClientState const &client);
+
+private:
+    class Writer;
+    class Reader;
+
+    static void write(Writer &, Parameters const &);
+    static void write(Writer &, Node const &);
+    static void read(Reader &, Parameters &);
+    static void read(Reader &, Node &, std::vector<TxPtr> const &);
+
+    char const *data = nullptr;
+    std::size_t size = 0;
+};
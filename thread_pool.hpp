@@ -0,0 +1,106 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+// Persistent pool of worker threads running data-parallel loops.
+//
+// parallel_for(n, f) calls f(0) ... f(n-1), each exactly once, on
+// the workers and the calling thread, and returns when all calls
+// are done. Callers are responsible for f(i) and f(j) touching
+// disjoint state.
+class ThreadPool
+{
+public:
+    // `threads` counts the calling thread; 0 means one per core.
+    explicit ThreadPool(unsigned threads = 1)
+    {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 1; i < threads; i++)
+            workers.emplace_back([this] { work(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stop = true;
+        }
+        start.notify_all();
+        for (auto &w : workers)
+            w.join();
+    }
+
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool &operator=(ThreadPool const &) = delete;
+
+    unsigned size() const { return unsigned(workers.size()) + 1; }
+
+    template <typename F>
+    void parallel_for(std::size_t n, F &&f)
+    {
+        if (workers.empty() || n < 2)
+        {
+            for (std::size_t i = 0; i < n; i++)
+                f(i);
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(m);
+        job = [&f](std::size_t i) { f(i); };
+        job_size = n;
+        next = 0;
+        finished = 0;
+        generation++;
+        lock.unlock();
+        start.notify_all();
+
+        run();
+
+        // every worker acknowledges the job before `f` goes out of scope.
+        lock.lock();
+        done.wait(lock, [this] { return finished == workers.size(); });
+        job = nullptr;
+    }
+
+private:
+    void run()
+    {
+        for (std::size_t i; (i = next.fetch_add(1)) < job_size;)
+            job(i);
+    }
+
+    void work()
+    {
+        std::size_t seen = 0;
+        for (;;)
+        {
+            std::unique_lock<std::mutex> lock(m);
+            start.wait(lock, [&] { return stop || generation != seen; });
+            if (stop)
+                return;
+            seen = generation;
+            lock.unlock();
+
+            run();
+
+            lock.lock();
+            if (++finished == workers.size())
+                done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex m;
+    std::condition_variable start, done;
+    std::function<void(std::size_t)> job;
+    std::size_t job_size = 0;
+    std::atomic<std::size_t> next{0};
+    std::size_t generation = 0, finished = 0;
+    bool stop = false;
+};
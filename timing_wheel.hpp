@@ -0,0 +1,138 @@
+#pragma once
+#include <vector>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+// Hierarchical timing wheel: a priority queue of events keyed by
+// integer time, with O(1) insertion and amortized O(1) removal.
+//
+// Level l has 256 slots, each covering 256^l time units; an event is
+// kept at the lowest level whose window contains both its time and
+// the current time, and is cascaded to lower levels as the current
+// time reaches its slot. Events more than 2^32 units ahead wait in an
+// overflow list. Events with the same time are popped in insertion
+// order.
+template <typename T>
+class TimingWheel
+{
+public:
+    using Time = std::uint64_t;
+
+    struct Entry
+    {
+        Time time;
+        std::uint64_t seq;
+        T event;
+    };
+
+    Time now() const { return current; }
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    void push(Time time, T event)
+    {
+        assert(time >= current);
+        count++;
+        if (time == current)
+            ready.push_back({time, seq++, std::move(event)});
+        else
+            place({time, seq++, std::move(event)});
+    }
+
+    // removes the next event; the current time moves to its time.
+    Entry pop()
+    {
+        assert(count > 0);
+        if (next == ready.size())
+            advance();
+        count--;
+        return std::move(ready[next++]);
+    }
+
+private:
+    static constexpr int Levels = 4, Bits = 8;
+    static constexpr Time Slots = Time(1) << Bits, Mask = Slots - 1;
+
+    static Time window(Time t, int level) { return t >> (Bits * level); }
+    static std::size_t slot(Time t, int level) { return window(t, level) & Mask; }
+
+    void place(Entry e)
+    {
+        for (int l = 0; l < Levels; l++)
+            if (window(e.time, l + 1) == window(current, l + 1))
+            {
+                wheel[l][slot(e.time, l)].push_back(std::move(e));
+                return;
+            }
+        overflow.push_back(std::move(e));
+    }
+
+    // moves the current time to the earliest pending event and
+    // makes the events at that time ready.
+    void advance()
+    {
+        ready.clear();
+        next = 0;
+        for (;;)
+        {
+            // an event at level 0 has the exact time of its slot.
+            for (auto s = slot(current, 0) + 1; s < Slots; s++)
+                if (!wheel[0][s].empty())
+                {
+                    current = (current & ~Mask) | s;
+                    ready.swap(wheel[0][s]);
+                    std::sort(ready.begin(), ready.end(),
+                              [](auto &a, auto &b) { return a.seq < b.seq; });
+                    return;
+                }
+            if (!cascade() || !ready.empty())
+                return;
+        }
+    }
+
+    // jumps to the start of the next non-empty slot of the lowest
+    // possible level and spreads its events over the lower levels.
+    bool cascade()
+    {
+        for (int l = 1; l < Levels; l++)
+            for (auto s = slot(current, l) + 1; s < Slots; s++)
+                if (!wheel[l][s].empty())
+                {
+                    auto width = Bits * l;
+                    current = (window(current, l + 1) << (width + Bits)) | (Time(s) << width);
+                    std::vector<Entry> entries;
+                    entries.swap(wheel[l][s]);
+                    spread(entries);
+                    return true;
+                }
+
+        if (overflow.empty())
+            return false;
+        auto first = std::min_element(overflow.begin(), overflow.end(),
+                                      [](auto &a, auto &b) { return a.time < b.time; });
+        current = first->time;
+        std::vector<Entry> entries;
+        entries.swap(overflow);
+        spread(entries);
+        return true;
+    }
+
+    void spread(std::vector<Entry> &entries)
+    {
+        for (auto &e : entries)
+            if (e.time == current)
+                ready.push_back(std::move(e));
+            else
+                place(std::move(e));
+        std::sort(ready.begin(), ready.end(),
+                  [](auto &a, auto &b) { return a.seq < b.seq; });
+    }
+
+    std::vector<Entry> wheel[Levels][Slots];
+    std::vector<Entry> overflow, ready;
+    std::size_t next = 0, count = 0;
+    std::uint64_t seq = 0;
+    Time current = 0;
+};
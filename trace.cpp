@@ -0,0 +1,99 @@
+#include "trace.hpp"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+
+#ifdef ZKS_TRACE
+namespace trace {
+
+bool enabled = false;
+
+namespace {
+struct Event {
+  char const *name;
+  int node;
+  uint64_t begin, end;
+};
+
+// beyond it, the spans of a thread are counted but dropped.
+const size_t max_events = size_t(1) << 22;
+
+struct Buffer {
+  int tid;
+  vector<Event> events;
+  uint64_t dropped = 0;
+};
+
+// timestamps and clock at start(), to convert the timestamps.
+uint64_t origin;
+chrono::steady_clock::time_point clock_origin;
+mutex m;
+vector<unique_ptr<Buffer>> buffers;
+
+Buffer &local() {
+  thread_local Buffer *b = [] {
+    lock_guard<mutex> lock(m);
+    buffers.push_back(make_unique<Buffer>());
+    buffers.back()->tid = int(buffers.size());
+    return buffers.back().get();
+  }();
+  return *b;
+}
+} // namespace
+
+void record(char const *name, int node, uint64_t begin, uint64_t end) {
+  auto &b = local();
+  if (b.events.size() < max_events)
+    b.events.push_back({name, node, begin, end});
+  else
+    b.dropped++;
+}
+
+void start() {
+  clock_origin = chrono::steady_clock::now();
+  origin = now();
+  enabled = true;
+}
+
+void write(string const &path) {
+  enabled = false;
+  auto ticks = now() - origin;
+  auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - clock_origin).count();
+  auto scale = ticks ? double(ns) / ticks : 1.0;
+  lock_guard<mutex> lock(m);
+  ofstream out(path);
+  out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+  out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"zks\"}}";
+  char line[256];
+  for (auto &b : buffers) {
+    out << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << b->tid
+        << ", \"args\": {\"name\": \"thread " << b->tid << "\", \"dropped\": " << b->dropped << "}}";
+    // timestamps and durations in µs, to the ns
+    for (auto &e : b->events) {
+      auto begin = uint64_t((e.begin - origin) * scale);
+      auto d = uint64_t((e.end - e.begin) * scale);
+      auto n = snprintf(line, sizeof line,
+                        ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                        "\"ts\": %llu.%03llu, \"dur\": %llu.%03llu",
+                        e.name, b->tid, (unsigned long long)begin / 1000,
+                        (unsigned long long)begin % 1000, (unsigned long long)d / 1000,
+                        (unsigned long long)d % 1000);
+      if (e.node >= 0)
+        n += snprintf(line + n, sizeof line - n, ", \"args\": {\"node\": %d}", e.node);
+      out.write(line, n);
+      out << '}';
+    }
+  }
+  out << "\n]}\n";
+  if (!out)
+    throw runtime_error("cannot write trace to " + path);
+}
+
+} // namespace trace
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+// Scoped spans of the simulation phases, written as a Chrome trace
+// (JSON, loaded by chrome://tracing and ui.perfetto.dev), one track
+// per thread.
+//
+// Compiled in with ZKS_TRACE defined (cmake -DZKS_TRACE=ON), then
+// recorded once start() is called (--trace); otherwise ZKS_SPAN
+// expands to nothing. Every thread appends to its own buffer,
+// without synchronization; the buffers are written by write(), once
+// the simulation threads are done.
+namespace trace
+{
+#ifdef ZKS_TRACE
+extern bool enabled;
+
+// raw timestamp: the TSC on x86-64, which unlike the clock is
+// never a system call, converted to time by write().
+inline std::uint64_t now()
+{
+#if defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+void record(char const *name, int node, std::uint64_t begin, std::uint64_t end);
+
+void start();
+void write(std::string const &path);
+
+class Span
+{
+public:
+    // `name` must outlive the trace (a literal).
+    Span(char const *name, int node)
+        : name(enabled ? name : nullptr), node(node), begin(enabled ? now() : 0) {}
+    ~Span()
+    {
+        if (name)
+            record(name, node, begin, now());
+    }
+    Span(Span const &) = delete;
+    Span &operator=(Span const &) = delete;
+
+private:
+    char const *name;
+    int node;
+    std::uint64_t begin;
+};
+#endif
+} // namespace trace
+
+#ifdef ZKS_TRACE
+#define ZKS_SPAN_CAT(a, b) a##b
+#define ZKS_SPAN_VAR(line) ZKS_SPAN_CAT(zks_span_, line)
+// span from here to the end of the scope, on the track of the
+// calling thread; `node` is shown as an argument (-1: none).
+#define ZKS_SPAN(name, node) ::trace::Span ZKS_SPAN_VAR(__LINE__)(name, node)
+#else
+#define ZKS_SPAN(name, node) ((void)0)
+#endif
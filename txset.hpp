@@ -0,0 +1,476 @@
+#pragma once
+#include <vector>
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <algorithm>
+
+// dense, network-wide handle of a transaction.
+using TxIndex = std::uint32_t;
+
+// TxBitset: compressed set of transaction indexes.
+//
+// The set is stored as a sorted vector of non-empty 64-bit words,
+// each tagged with its position (index >> 6). Ancestor closures are
+// dense around recent transactions and sparse elsewhere, so this
+// keeps them at roughly one bit per member while union, membership
+// and iteration stay allocation free.
+class TxBitset
+{
+public:
+    struct Word
+    {
+        TxIndex key;
+        std::uint64_t bits;
+    };
+
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = TxIndex;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const TxIndex *;
+        using reference = TxIndex;
+
+        const_iterator(const Word *w, const Word *end)
+            : w(w), end(end), bits(w != end ? w->bits : 0) {}
+
+        const_iterator(const Word *w, const Word *end, std::uint64_t bits)
+            : w(w), end(end), bits(bits) {}
+
+        TxIndex operator*() const
+        {
+            return TxIndex((w->key << 6) + __builtin_ctzll(bits));
+        }
+
+        const_iterator &operator++()
+        {
+            bits &= bits - 1;
+            if (!bits && ++w != end)
+                bits = w->bits;
+            return *this;
+        }
+
+        bool operator==(const_iterator const &it) const
+        {
+            return w == it.w && bits == it.bits;
+        }
+
+        bool operator!=(const_iterator const &it) const
+        {
+            return !(*this == it);
+        }
+
+    private:
+        const Word *w, *end;
+        std::uint64_t bits;
+    };
+
+    const_iterator begin() const
+    {
+        return {words.data(), words.data() + words.size()};
+    }
+
+    const_iterator end() const
+    {
+        return {words.data() + words.size(), words.data() + words.size()};
+    }
+
+    // the members from idx on.
+    const_iterator lower_bound(TxIndex idx) const
+    {
+        auto e = words.data() + words.size();
+        auto w = words.data() + (find(idx >> 6) - words.begin());
+        if (w != e && w->key == (idx >> 6))
+        {
+            if (auto bits = w->bits & (~std::uint64_t(0) << (idx & 63)))
+                return {w, e, bits};
+            ++w;
+        }
+        return {w, e};
+    }
+
+    bool empty() const { return words.empty(); }
+
+    std::size_t size() const
+    {
+        std::size_t n = 0;
+        for (auto &w : words)
+            n += __builtin_popcountll(w.bits);
+        return n;
+    }
+
+    bool contains(TxIndex idx) const
+    {
+        auto it = find(idx >> 6);
+        return it != words.end() && it->key == (idx >> 6) &&
+               (it->bits >> (idx & 63)) & 1;
+    }
+
+    // bits of indexes [64 * key, 64 * (key + 1)[
+    std::uint64_t word(TxIndex key) const
+    {
+        auto it = find(key);
+        return it != words.end() && it->key == key ? it->bits : 0;
+    }
+
+    void insert(TxIndex idx)
+    {
+        auto key = TxIndex(idx >> 6);
+        auto bit = std::uint64_t(1) << (idx & 63);
+        if (!words.empty() && words.back().key == key)
+            words.back().bits |= bit;
+        else if (words.empty() || words.back().key < key)
+            words.push_back({key, bit});
+        else if (auto it = find(key); it->key == key)
+            it->bits |= bit;
+        else
+            words.insert(it, {key, bit});
+    }
+
+    void erase(TxIndex idx)
+    {
+        auto it = find(idx >> 6);
+        if (it == words.end() || it->key != (idx >> 6))
+            return;
+        it->bits &= ~(std::uint64_t(1) << (idx & 63));
+        if (!it->bits)
+            words.erase(it);
+    }
+
+    // |this ∩ other| and whether it is not empty, a word at a
+    // time: the words of the smaller set are searched for in the
+    // larger one, from the last one found on.
+    std::size_t common(TxBitset const &other) const
+    {
+        std::size_t n = 0;
+        forEachCommon(other, [&n](std::uint64_t bits) {
+            n += __builtin_popcountll(bits);
+            return true;
+        });
+        return n;
+    }
+
+    bool intersects(TxBitset const &other) const
+    {
+        return !forEachCommon(other, [](std::uint64_t) { return false; });
+    }
+
+    // this := this ∪ other
+    void merge(TxBitset const &other)
+    {
+        if (other.words.empty())
+            return;
+        if (words.empty())
+        {
+            words = other.words;
+            return;
+        }
+        std::vector<Word> rc;
+        rc.reserve(words.size() + other.words.size());
+        auto a = words.cbegin(), b = other.words.cbegin();
+        while (a != words.cend() && b != other.words.cend())
+            if (a->key < b->key)
+                rc.push_back(*a++);
+            else if (b->key < a->key)
+                rc.push_back(*b++);
+            else
+            {
+                rc.push_back({a->key, a->bits | b->bits});
+                ++a, ++b;
+            }
+        rc.insert(rc.end(), a, words.cend());
+        rc.insert(rc.end(), b, other.words.cend());
+        words.swap(rc);
+    }
+
+    void clear() { words.clear(); }
+
+    // removes the members below `below` that are not in `keep`.
+    void prune(TxIndex below, TxBitset const &keep)
+    {
+        auto out = words.begin();
+        for (auto it = words.begin(); it != words.end(); ++it)
+        {
+            auto w = *it;
+            if (w.key <= (below >> 6))
+            {
+                auto low = w.key < (below >> 6)
+                               ? ~std::uint64_t(0)
+                               : (std::uint64_t(1) << (below & 63)) - 1;
+                auto k = keep.find(w.key);
+                auto kept = k != keep.words.end() && k->key == w.key ? k->bits : 0;
+                w.bits &= ~low | kept;
+            }
+            if (w.bits)
+                *out++ = w;
+        }
+        words.erase(out, words.end());
+    }
+
+    std::vector<Word> const &data() const { return words; }
+    std::size_t bytes() const { return words.capacity() * sizeof(Word); }
+
+    bool operator==(TxBitset const &other) const
+    {
+        return words.size() == other.words.size() &&
+               std::equal(words.begin(), words.end(), other.words.begin(),
+                          [](auto &a, auto &b) { return a.key == b.key && a.bits == b.bits; });
+    }
+
+private:
+    friend class Snapshot;
+
+    // calls f on the non-empty common bits of every word, until it
+    // returns false; returns whether it never did.
+    template <typename F>
+    bool forEachCommon(TxBitset const &other, F f) const
+    {
+        auto &a = words.size() <= other.words.size() ? words : other.words;
+        auto &b = &a == &words ? other.words : words;
+        auto it = b.begin();
+        for (auto &w : a)
+        {
+            it = std::lower_bound(it, b.end(), w.key,
+                                  [](Word const &x, TxIndex k) { return x.key < k; });
+            if (it == b.end())
+                break;
+            if (auto bits = it->key == w.key ? w.bits & it->bits : 0; bits && !f(bits))
+                return false;
+        }
+        return true;
+    }
+
+    std::vector<Word>::const_iterator find(TxIndex key) const
+    {
+        return std::lower_bound(words.begin(), words.end(), key,
+                                [](Word const &w, TxIndex k) { return w.key < k; });
+    }
+
+    std::vector<Word>::iterator find(TxIndex key)
+    {
+        return std::lower_bound(words.begin(), words.end(), key,
+                                [](Word const &w, TxIndex k) { return w.key < k; });
+    }
+
+    std::vector<Word> words;
+};
+
+// TxBitmap: dense bitmap over transaction indexes, grown on demand.
+// Used for per-node flags, which are set for most known transactions.
+// The bits below a base can be dropped (see rebase); they then all
+// read as the same value, except for the few indexes kept.
+class TxBitmap
+{
+public:
+    bool test(TxIndex idx) const
+    {
+        return (word(idx >> 6) >> (idx & 63)) & 1;
+    }
+
+    void set(TxIndex idx)
+    {
+        if ((idx >> 6) < offset)
+        {
+            if (kept.contains(idx))
+                kept_set.insert(idx);
+            return;
+        }
+        grow(std::size_t(idx) + 1);
+        words[(idx >> 6) - offset] |= std::uint64_t(1) << (idx & 63);
+    }
+
+    void reset(TxIndex idx)
+    {
+        if ((idx >> 6) < offset)
+            kept_set.erase(idx);
+        else if ((idx >> 6) - offset < words.size())
+            words[(idx >> 6) - offset] &= ~(std::uint64_t(1) << (idx & 63));
+    }
+
+    // makes room for indexes up to n - 1
+    void grow(std::size_t n)
+    {
+        if ((n + 63) / 64 > offset + words.size())
+            words.resize((n + 63) / 64 - offset);
+    }
+
+    std::size_t count() const
+    {
+        std::size_t n = fill ? 64 * offset - kept.size() : 0;
+        n += kept_set.size();
+        for (auto w : words)
+            n += __builtin_popcountll(w);
+        return n;
+    }
+
+    std::size_t bytes() const
+    {
+        return words.capacity() * sizeof(std::uint64_t) + kept.bytes() + kept_set.bytes();
+    }
+
+    // bits of indexes [64 * i, 64 * (i + 1)[
+    std::uint64_t word(std::size_t i) const
+    {
+        if (i < offset)
+        {
+            auto k = kept.empty() ? 0 : kept.word(TxIndex(i));
+            return ((fill ? ~std::uint64_t(0) : 0) & ~k) | (k ? kept_set.word(TxIndex(i)) : 0);
+        }
+        return i - offset < words.size() ? words[i - offset] : 0;
+    }
+
+    // forgets the bits below `base`, a multiple of 64, which then
+    // read as `value`, except for the ones of `keep`.
+    void rebase(TxIndex base, bool value, TxBitset const &keep = {})
+    {
+        TxBitset k, s;
+        for (auto idx : keep)
+        {
+            if (idx >= base)
+                break;
+            k.insert(idx);
+            if (test(idx))
+                s.insert(idx);
+        }
+        kept = std::move(k);
+        kept_set = std::move(s);
+        auto n = std::min<std::size_t>(base / 64 - offset, words.size());
+        drop(n);
+        offset = base / 64;
+        fill = value;
+    }
+
+    // drops the leading words whose bits are all set, which then
+    // read as set, when nothing was dropped yet or they read so.
+    void trim()
+    {
+        if (offset && !fill)
+            return;
+        std::size_t n = 0;
+        while (n < words.size() && words[n] == ~std::uint64_t(0))
+            n++;
+        if (n == 0 && offset)
+            return;
+        drop(n);
+        offset += n;
+        fill = true;
+    }
+
+    // drops the bit of a kept index, which then reads as the rest.
+    void forget(TxIndex idx)
+    {
+        kept.erase(idx);
+        kept_set.erase(idx);
+    }
+
+    void shrink() { words.shrink_to_fit(); }
+
+private:
+    friend class Snapshot;
+
+    // erases the first n words, releasing the memory once most of
+    // it is unused, so that bytes() follows.
+    void drop(std::size_t n)
+    {
+        words.erase(words.begin(), words.begin() + n);
+        if (2 * words.size() < words.capacity())
+            words.shrink_to_fit();
+    }
+
+    std::vector<std::uint64_t> words;
+    std::size_t offset = 0; // in words
+    bool fill = false;
+    TxBitset kept, kept_set; // kept below the offset, and set
+};
+
+// TxArray: per-transaction values, indexed by TxIndex, for the
+// indexes from a base on and the few kept below it (see rebase).
+template <typename T>
+class TxArray
+{
+public:
+    T &operator[](TxIndex idx) { return idx < first ? low(idx) : values[idx - first]; }
+    T const &operator[](TxIndex idx) const
+    {
+        return idx < first ? const_cast<TxArray *>(this)->low(idx) : values[idx - first];
+    }
+
+    // first and one past the last index
+    TxIndex base() const { return first; }
+    std::size_t size() const { return first + values.size(); }
+    void resize(std::size_t n) { values.resize(n - first); }
+    std::size_t bytes() const
+    {
+        return values.capacity() * sizeof(T) + kept.capacity() * sizeof(Kept);
+    }
+
+    // forgets the values below `b`, except for the ones of `keep`.
+    void rebase(TxIndex b, TxBitset const &keep = {})
+    {
+        std::vector<Kept> k;
+        for (auto idx : keep)
+        {
+            if (idx >= b)
+                break;
+            k.push_back({idx, (*this)[idx]});
+        }
+        kept.swap(k);
+        values.erase(values.begin(), values.begin() + (b - first));
+        // as TxBitmap::drop
+        if (2 * values.size() < values.capacity())
+            values.shrink_to_fit();
+        first = b;
+    }
+
+    // drops the value of a kept index.
+    void forget(TxIndex idx)
+    {
+        auto it = find(idx);
+        if (it != kept.end() && it->idx == idx)
+            kept.erase(it);
+    }
+
+    void shrink()
+    {
+        values.shrink_to_fit();
+        kept.shrink_to_fit();
+    }
+
+private:
+    friend class Snapshot;
+
+    struct Kept
+    {
+        TxIndex idx;
+        T value;
+    };
+
+    typename std::vector<Kept>::iterator find(TxIndex idx)
+    {
+        return std::lower_bound(kept.begin(), kept.end(), idx,
+                                [](Kept const &e, TxIndex i) { return e.idx < i; });
+    }
+
+    T &low(TxIndex idx)
+    {
+        auto it = find(idx);
+        assert(it != kept.end() && it->idx == idx);
+        return it->value;
+    }
+
+    TxIndex first = 0;
+    std::vector<T> values;
+    std::vector<Kept> kept; // below first, sorted
+};
+
+// calls f on every member of `set` that is not in `map`, in
+// increasing order, a word at a time. `map` may be updated by f.
+template <typename F>
+void forEachMissing(TxBitset const &set, TxBitmap const &map, F f)
+{
+    for (auto &w : set.data())
+        for (auto bits = w.bits & ~map.word(w.key); bits; bits &= bits - 1)
+            f(TxIndex((w.key << 6) + __builtin_ctzll(bits)));
+}